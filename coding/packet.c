@@ -1,97 +1,466 @@
+#define _GNU_SOURCE             // sendmmsg / recvmmsg
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY   60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY  0x4000000
+#endif
 
 #define MBUF_HEADROOM 128
+#define CACHE_LINE    64
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+/* buffer 按 headroom + 数据区 分级，mbuf_alloc 取能装下的最小一级 */
+#define MBUF_NUM_CLASSES  3
+#define MBUF_MAX_POOLS    (MBUF_NUM_CLASSES + 2)   // 再加 clone pool 和外部 buffer 的 info pool
+#define MBUF_CHUNK_SIZE   (2UL << 20)              // pool 每次扩容 mmap 这么大
+#define MBUF_CACHE_SIZE   64                       // 线程 cache 容量
+#define MBUF_CACHE_BATCH  32                       // 线程 cache 与全局空闲链表之间一次搬这么多
+#define MBUF_BULK_MAX     MBUF_CACHE_SIZE          // *_bulk 内部一轮最多处理这么多个
+#define MBUF_MAX_SEG      2048                     // 追加时新分片容量的默认上限，mbuf_set_max_seg 可改
+
+struct mbuf_pool;
 
 //共享结构体
 typedef struct mbuf_shared_info {
     atomic_int refcnt; // 引用计数，用于写时复制
     unsigned char *head; // 缓冲区起始地址
     unsigned char *end; // 缓冲区结束地址（容量边界）
-    unsigned char buffer[]; // 柔性数组，实际数据紧跟在结构体后
+    struct mbuf_pool *pool; // 所在 pool，引用归零时整个对象还回去
+    void (*free_cb)(void *addr, void *opaque); // 外部 buffer：最后一个引用放掉时回调，自带的为 NULL
+    void *opaque;
+    unsigned char buffer[] __attribute__((aligned(CACHE_LINE))); // 柔性数组，实际数据紧跟在结构体后
 } mbuf_shared_info_t;
 
+#define MBUF_F_CLONE  (1 << 0)  // 来自 clone pool，只有 mbuf_t 没有自带 buffer
+
 //视图
 typedef struct mbuf {
     struct mbuf *next;          // 用于组成普通队列（packet queue）
     struct mbuf *next_frag;     // 指向下一个分片（fragment），实现 scatter-gather
+    struct mbuf *last_frag;     // 最后一个分片（仅 head 有效，NULL 表示未知、用时现找）
     int pkt_len;                // 整个包的总长度（仅 head mbuf 有效）
+    uint16_t flags;             // MBUF_F_*
     mbuf_shared_info_t *sh;     // 指向共享的缓冲区信息（支持 CoW）
     unsigned char *head;        // 本 mbuf 对应的缓冲区起始
     unsigned char *data;        // 数据起始指针（可前推留 headroom）
     unsigned char *tail;        // 数据结束指针（写入从这里开始）
     unsigned char *end;         // 缓冲区容量结束
-} mbuf_t;
+} __attribute__((aligned(CACHE_LINE))) mbuf_t;
+
+/*
+ * 一个 pool 对象 = mbuf_t + shared info + headroom + 数据区，一次分配：
+ *   [mbuf_t | pad][mbuf_shared_info_t][buffer: headroom | data ...]
+ *   ^ MBUF_META_SIZE 处是 sh，buffer 从 cache line 边界开始
+ * 自带的 mbuf_t 对自家 sh 持有一个引用（home 引用），所以 mbuf_t 活着对象就不会被回收；
+ * CoW 换到别的 buffer 后 home 引用仍留着，free 时一起放
+ */
+#define MBUF_META_SIZE ALIGN_UP(sizeof(mbuf_t), CACHE_LINE)
+
+typedef struct mbuf_pool {
+    const char *name;
+    int id;                     // 线程 cache 下标
+    size_t elt_size;            // 对象步长，cache line 对齐
+    int data_room;              // headroom + 数据区，0 表示 clone pool
+
+    atomic_flag lock;           // 保护下面几项，慢路径
+    void *free_list;            // 空闲对象单链表，链接借用对象开头的 mbuf_t.next
+    uint8_t *carve;             // bump 区：mmap 了但还没发出去过的对象
+    int carve_left;
+} mbuf_pool_t;
 static inline int mbuf_len(mbuf_t *m) { return m->tail - m->data; }
 static inline int mbuf_tailroom(mbuf_t *m) { return m->end - m->tail; }
 static inline int mbuf_headroom(mbuf_t *m) { return m->data - m->head; }
 
 /* ==========================================
- * 2. 内存管理 (Alloc/Free/COW)
+ * 2. 内存池 (DPDK mempool 风格)
+ * ========================================== */
+// 对象只在 mmap 来的 chunk 里切，alloc / free 不碰 malloc
+// 快路径是线程 cache 的数组，空了 / 满了才成批找全局空闲链表
+
+// 各级 headroom + 数据区：小分片、标准 MTU、巨帧
+static const int mbuf_rooms[MBUF_NUM_CLASSES] = {
+    256,
+    2048 + MBUF_HEADROOM,
+    9216 + MBUF_HEADROOM,
+};
+
+static int g_max_seg = MBUF_MAX_SEG;
+
+static mbuf_pool_t g_pkt_pools[MBUF_NUM_CLASSES];
+static mbuf_pool_t g_clone_pool;
+static mbuf_pool_t g_ext_pool;          // 外部 buffer 的 shared info，对象就是一个 mbuf_shared_info_t
+static mbuf_pool_t *g_pools_by_id[MBUF_MAX_POOLS];
+static pthread_once_t g_pools_once = PTHREAD_ONCE_INIT;
+
+typedef struct {
+    int count;
+    void *objs[MBUF_CACHE_SIZE];
+} mbuf_cache_t;
+
+static __thread mbuf_cache_t t_mbuf_cache[MBUF_MAX_POOLS];  // 按 pool id 索引
+static __thread bool t_mbuf_attached;                       // 已挂上线程退出的析构
+static pthread_key_t g_cache_key;
+
+static inline void pool_lock(mbuf_pool_t *mp) {
+    while (atomic_flag_test_and_set_explicit(&mp->lock, memory_order_acquire))
+        ;
+}
+
+static inline void pool_unlock(mbuf_pool_t *mp) {
+    atomic_flag_clear_explicit(&mp->lock, memory_order_release);
+}
+
+static inline mbuf_shared_info_t *mbuf_home_sh(void *obj) {
+    return (mbuf_shared_info_t *)((uint8_t *)obj + MBUF_META_SIZE);
+}
+
+// 不变的字段在切出来时填一次，之后每次 alloc 只重置会变的几项
+static void pool_obj_init(mbuf_pool_t *mp, void *obj) {
+    if (mp == &g_ext_pool)
+        return;         // attach 时整个填
+    mbuf_t *m = obj;
+    memset(m, 0, sizeof(*m));
+    if (mp->data_room == 0) {
+        m->flags = MBUF_F_CLONE;
+        return;
+    }
+    mbuf_shared_info_t *sh = mbuf_home_sh(obj);
+    sh->pool = mp;
+    sh->head = sh->buffer;
+    sh->end  = sh->buffer + mp->data_room;
+    sh->free_cb = NULL;
+}
+
+// 调用者持锁；切完了再映射一个 chunk
+static int pool_carve(mbuf_pool_t *mp, void **objs, int n) {
+    if (mp->carve_left == 0) {
+        size_t sz = mp->elt_size > MBUF_CHUNK_SIZE ? mp->elt_size : MBUF_CHUNK_SIZE;
+        void *chunk = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED)
+            return 0;
+        mp->carve = chunk;
+        mp->carve_left = sz / mp->elt_size;
+    }
+
+    int got = n < mp->carve_left ? n : mp->carve_left;
+    for (int i = 0; i < got; i++) {
+        objs[i] = mp->carve;
+        pool_obj_init(mp, objs[i]);
+        mp->carve += mp->elt_size;
+    }
+    mp->carve_left -= got;
+    return got;
+}
+
+// 慢路径：成批从全局拿，空闲链表不够再切
+static int pool_get_bulk(mbuf_pool_t *mp, void **objs, int n) {
+    int got = 0;
+    pool_lock(mp);
+    while (got < n && mp->free_list) {
+        objs[got] = mp->free_list;
+        mp->free_list = ((mbuf_t *)objs[got])->next;
+        got++;
+    }
+    if (got < n)
+        got += pool_carve(mp, objs + got, n - got);
+    pool_unlock(mp);
+    return got;
+}
+
+static void pool_put_bulk(mbuf_pool_t *mp, void **objs, int n) {
+    if (n <= 0) return;
+    // 先在锁外串好，锁内只改表头
+    for (int i = 0; i < n - 1; i++)
+        ((mbuf_t *)objs[i])->next = objs[i + 1];
+    pool_lock(mp);
+    ((mbuf_t *)objs[n - 1])->next = mp->free_list;
+    mp->free_list = objs[0];
+    pool_unlock(mp);
+}
+
+// 线程退出：cache 里的对象还给全局
+static void mbuf_cache_flush_all(void *arg) {
+    (void)arg;
+    for (int i = 0; i < MBUF_MAX_POOLS; i++) {
+        mbuf_cache_t *c = &t_mbuf_cache[i];
+        pool_put_bulk(g_pools_by_id[i], c->objs, c->count);
+        c->count = 0;
+    }
+}
+
+static void pool_setup(mbuf_pool_t *mp, const char *name, int id, int data_room) {
+    mp->name = name;
+    mp->id = id;
+    g_pools_by_id[id] = mp;
+    mp->data_room = data_room;
+    mp->elt_size = data_room ? ALIGN_UP(MBUF_META_SIZE + sizeof(mbuf_shared_info_t) + data_room,
+                                        CACHE_LINE)
+                             : MBUF_META_SIZE;
+    atomic_flag_clear(&mp->lock);
+    mp->free_list = NULL;
+    mp->carve = NULL;
+    mp->carve_left = 0;
+}
+
+static void mbuf_pools_init(void) {
+    static const char *names[MBUF_NUM_CLASSES] = { "mbuf_small", "mbuf_mtu", "mbuf_jumbo" };
+    for (int i = 0; i < MBUF_NUM_CLASSES; i++)
+        pool_setup(&g_pkt_pools[i], names[i], i, mbuf_rooms[i]);
+    pool_setup(&g_clone_pool, "mbuf_clone", MBUF_NUM_CLASSES, 0);
+    pool_setup(&g_ext_pool, "mbuf_extinfo", MBUF_NUM_CLASSES + 1, 0);
+    pthread_key_create(&g_cache_key, mbuf_cache_flush_all);
+}
+
+// 第一次用时挂上析构，线程退出时把 cache 还回去；只 free 不 alloc 的线程也要挂
+static inline mbuf_cache_t *pool_cache(mbuf_pool_t *mp) {
+    if (__builtin_expect(!t_mbuf_attached, 0)) {
+        pthread_setspecific(g_cache_key, t_mbuf_cache);
+        t_mbuf_attached = true;
+    }
+    return &t_mbuf_cache[mp->id];
+}
+
+static inline void *pool_get(mbuf_pool_t *mp) {
+    mbuf_cache_t *c = pool_cache(mp);
+    if (__builtin_expect(c->count == 0, 0)) {
+        c->count = pool_get_bulk(mp, c->objs, MBUF_CACHE_BATCH);
+        if (c->count == 0)
+            return NULL;
+    }
+    return c->objs[--c->count];
+}
+
+static inline void pool_put(mbuf_pool_t *mp, void *obj) {
+    mbuf_cache_t *c = pool_cache(mp);
+    if (__builtin_expect(c->count == MBUF_CACHE_SIZE, 0)) {
+        pool_put_bulk(mp, &c->objs[MBUF_CACHE_SIZE - MBUF_CACHE_BATCH], MBUF_CACHE_BATCH);
+        c->count -= MBUF_CACHE_BATCH;
+    }
+    c->objs[c->count++] = obj;
+}
+
+// 一次拿 n 个（n <= MBUF_BULK_MAX），要么全给要么不给
+static int pool_get_n(mbuf_pool_t *mp, void **objs, int n) {
+    mbuf_cache_t *c = pool_cache(mp);
+    if (c->count < n) {
+        c->count += pool_get_bulk(mp, &c->objs[c->count], MBUF_CACHE_SIZE - c->count);
+        if (c->count < n)
+            return -1;
+    }
+    c->count -= n;
+    memcpy(objs, &c->objs[c->count], n * sizeof(void *));
+    return 0;
+}
+
+// 一次还 n 个（n <= MBUF_BULK_MAX），放不下先把 cache 顶上多出来的那截还给全局
+static void pool_put_n(mbuf_pool_t *mp, void **objs, int n) {
+    mbuf_cache_t *c = pool_cache(mp);
+    int over = c->count + n - MBUF_CACHE_SIZE;
+    if (over > 0) {
+        over += MBUF_CACHE_BATCH;
+        if (over > c->count)
+            over = c->count;
+        pool_put_bulk(mp, &c->objs[c->count - over], over);
+        c->count -= over;
+    }
+    memcpy(&c->objs[c->count], objs, n * sizeof(void *));
+    c->count += n;
+}
+
+// size（headroom + 数据）-> 能装下的最小一级，超过巨帧返回 NULL
+static mbuf_pool_t *pool_for_room(int room) {
+    pthread_once(&g_pools_once, mbuf_pools_init);
+    for (int i = 0; i < MBUF_NUM_CLASSES; i++)
+        if (room <= mbuf_rooms[i])
+            return &g_pkt_pools[i];
+    return NULL;
+}
+
+// 引用归零后要还给 sh->pool 的对象：自带的是整个 pool 对象；外部的先回调，还的是 info 本身
+static inline void *sh_release(mbuf_shared_info_t *sh) {
+    if (sh->pool != &g_ext_pool)
+        return (uint8_t *)sh - MBUF_META_SIZE;
+    if (sh->free_cb)
+        sh->free_cb(sh->head, sh->opaque);
+    return sh;
+}
+
+static inline void sh_put(mbuf_shared_info_t *sh) {
+    if (atomic_fetch_sub(&sh->refcnt, 1) == 1)
+        pool_put(sh->pool, sh_release(sh));
+}
+
+// 能原地写：没人共享，而且不是外部 buffer（可能是只读映射的文件，一律先 CoW）
+static inline bool sh_writable(mbuf_shared_info_t *sh) {
+    return atomic_load(&sh->refcnt) == 1 && sh->pool != &g_ext_pool;
+}
+
+// 只要一块 buffer（CoW 用）：对象自带的 mbuf_t 闲着，引用归零时整个对象回 pool
+static mbuf_shared_info_t *sh_alloc(int room) {
+    mbuf_pool_t *mp = pool_for_room(room);
+    void *obj = mp ? pool_get(mp) : NULL;
+    if (!obj) return NULL;
+
+    mbuf_shared_info_t *sh = mbuf_home_sh(obj);
+    atomic_init(&sh->refcnt, 1);
+    return sh;
+}
+
+/* ==========================================
+ * 3. 内存管理 (Alloc/Free/COW)
  * ========================================== */
-// ... (COW 和 Alloc/Free 代码复用之前的，为节省篇幅略去实现细节，逻辑一致) ...
+
+// 自带 buffer 的 mbuf 返回自家 sh，clone 返回 NULL
+static inline mbuf_shared_info_t *mbuf_home(mbuf_t *m) {
+    return (m->flags & MBUF_F_CLONE) ? NULL : mbuf_home_sh(m);
+}
+
+static void mbuf_free_one(mbuf_t *m) {
+    mbuf_shared_info_t *home = mbuf_home(m);
+    if (m->sh != home)
+        sh_put(m->sh);
+    if (home)
+        sh_put(home);       // 最后一个引用连同 mbuf_t 一起回 pool
+    else
+        pool_put(&g_clone_pool, m);
+}
 
 void mbuf_free_chain(mbuf_t *m) {
     while (m) {
         mbuf_t *next = m->next_frag;
-        mbuf_shared_info_t *sh = m->sh;
-        free(m);
-        if (atomic_fetch_sub(&sh->refcnt, 1) == 1) free(sh);
+        mbuf_free_one(m);
         m = next;
     }
 }
 
-// 简单的 alloc 实现，确保可运行
-mbuf_t *mbuf_alloc(int payload_size) {
-    int total_size = payload_size + MBUF_HEADROOM;
-    mbuf_shared_info_t *sh = malloc(sizeof(*sh) + total_size);
+// 刚从 pool 拿出来的对象：只重置每次会变的字段
+static inline void mbuf_reset(mbuf_t *m, int headroom, int payload_size) {
+    mbuf_shared_info_t *sh = mbuf_home_sh(m);
     atomic_init(&sh->refcnt, 1);
-    sh->head = sh->buffer;
-    sh->end  = sh->buffer + total_size;
-
-    mbuf_t *m = calloc(1, sizeof(*m));
+    m->next = NULL;
+    m->next_frag = NULL;
+    m->last_frag = m;
+    m->pkt_len = 0;
     m->sh = sh;
     m->head = sh->head;
-    m->data = sh->head + MBUF_HEADROOM;
-    m->tail = sh->head + MBUF_HEADROOM;
-    m->end  = sh->end;
+    m->data = sh->head + headroom;
+    m->tail = sh->head + headroom;
+    m->end  = m->data + payload_size;   // 按要的给，级别里多出来的不露给调用者
+}
+
+// payload_size + MBUF_HEADROOM 超过最大一级（巨帧）时返回 NULL
+mbuf_t *mbuf_alloc(int payload_size) {
+    mbuf_pool_t *mp = pool_for_room(payload_size + MBUF_HEADROOM);
+    mbuf_t *m = mp ? pool_get(mp) : NULL;
+    if (!m) return NULL;
+
+    mbuf_reset(m, MBUF_HEADROOM, payload_size);
+    return m;
+}
+
+// 分片不留 headroom（只有 head 需要往前推协议头），容量给满所在级别但不超过 max_seg
+static mbuf_t *mbuf_alloc_frag(int size) {
+    mbuf_pool_t *mp = pool_for_room(size);
+    mbuf_t *m = mp ? pool_get(mp) : NULL;
+    if (!m) return NULL;
+
+    int cap = mp->data_room < g_max_seg ? mp->data_room : g_max_seg;
+    mbuf_reset(m, 0, cap > size ? cap : size);
     return m;
 }
 
-// COW 简化版
-static void mbuf_ensure_writable(mbuf_t *m) {
+// 追加时新分片的容量上限；超过最大一级的按最大一级算
+void mbuf_set_max_seg(int seg) {
+    int top = mbuf_rooms[MBUF_NUM_CLASSES - 1];
+    g_max_seg = seg < 64 ? 64 : seg > top ? top : seg;
+}
+
+// m 换到新 buffer sh 上：headroom 偏移不变，拷前 len 字节数据，容量 cap
+// 原来的是自家的就留着 home 引用
+static void mbuf_rebind(mbuf_t *m, mbuf_shared_info_t *sh, int len, int cap) {
     mbuf_shared_info_t *old = m->sh;
-    if (atomic_load(&old->refcnt) == 1) return;
-    int size = old->end - old->head;
-    mbuf_shared_info_t *sh = malloc(sizeof(*sh) + size);
-    atomic_init(&sh->refcnt, 1);
-    sh->head = sh->buffer;
-    sh->end  = sh->buffer + size;
-    memcpy(sh->buffer, old->head, size);
-    ptrdiff_t offset = m->data - old->head;
-    ptrdiff_t len = m->tail - m->data;
-    atomic_fetch_sub(&old->refcnt, 1);
+    ptrdiff_t offset = m->data - m->head;
+    memcpy(sh->head + offset, m->data, len);
+    if (old != mbuf_home(m))
+        sh_put(old);
     m->sh = sh;
     m->head = sh->head;
     m->data = sh->head + offset;
     m->tail = m->data + len;
-    m->end  = sh->end;
+    m->end  = sh->head + cap;
+}
+
+// 换到一块独占的新 buffer，tailroom 至少 extra；超过最大一级返回 -1
+static int mbuf_realloc(mbuf_t *m, int extra) {
+    int len = m->tail - m->data;
+    int cap = m->end - m->head;
+    if (cap < (m->data - m->head) + len + extra)
+        cap = (m->data - m->head) + len + extra;
+
+    mbuf_shared_info_t *sh = sh_alloc(cap);
+    if (!sh) return -1;
+    mbuf_rebind(m, sh, len, cap);
+    return 0;
 }
 
-void mbuf_append_large(mbuf_t *head, const void *buf, int len) {
-    mbuf_t *curr = head;
-    while (curr->next_frag) curr = curr->next_frag;
+// COW 简化版；拷不出私有 buffer 返回 -1，m 原样留着
+static int mbuf_ensure_writable(mbuf_t *m) {
+    if (sh_writable(m->sh)) return 0;
+    return mbuf_realloc(m, 0);
+}
+
+// 直接改了 next_frag 的调用者要同步 last_frag，或者把它置 NULL
+static inline mbuf_t *mbuf_last(mbuf_t *head) {
+    mbuf_t *last = head->last_frag;
+    if (!last) {
+        for (last = head; last->next_frag; last = last->next_frag)
+            ;
+        head->last_frag = last;
+    }
+    return last;
+}
+
+// 分配不到新分片、或共享的 head 拷不出来返回 -1，已追加的部分留着
+int mbuf_append_large(mbuf_t *head, const void *buf, int len) {
+    mbuf_t *curr = mbuf_last(head);
     const unsigned char *p = buf;
     int remain = len;
     while (remain > 0) {
-        mbuf_ensure_writable(curr);
+        // 共享的 head 先 CoW（头要连续）；共享的后续分片不拷，直接另起新分片
         int room = mbuf_tailroom(curr);
-        if (room > 0) {
+        if (room > 0 && curr == head && !sh_writable(curr->sh) &&
+            mbuf_ensure_writable(curr) < 0)
+            return -1;
+        if (room > 0 && sh_writable(curr->sh)) {
             int n = remain < room ? remain : room;
             memcpy(curr->tail, p, n);
             curr->tail += n;
@@ -99,11 +468,18 @@ void mbuf_append_large(mbuf_t *head, const void *buf, int len) {
             p += n;
             remain -= n;
         } else {
-            mbuf_t *frag = mbuf_alloc(128);
+            // 按剩下的长度要，且至少是上一个分片的两倍：一点点追加的流也很快长到 max_seg
+            int want = 2 * (curr->end - curr->data);
+            if (want < remain) want = remain;
+            if (want > g_max_seg) want = g_max_seg;
+            mbuf_t *frag = mbuf_alloc_frag(want);
+            if (!frag) return -1;
             curr->next_frag = frag;
             curr = frag;
+            head->last_frag = frag;
         }
     }
+    return 0;
 }
 /* ==========================================
  * 补全：链式克隆 (工业级标准实现)
@@ -113,15 +489,18 @@ void mbuf_append_large(mbuf_t *head, const void *buf, int len) {
 static mbuf_t *__mbuf_clone_one(mbuf_t *src) {
     if (!src) return NULL;
 
-    mbuf_t *dst = malloc(sizeof(*dst));
+    pthread_once(&g_pools_once, mbuf_pools_init);
+    mbuf_t *dst = pool_get(&g_clone_pool);
     if (!dst) return NULL;
 
-    // 1. 复制元数据 (copy struct fields)
+    // 1. 复制元数据 (copy struct fields)，但它只是个视图，不带 buffer
     *dst = *src;
-    
+    dst->flags |= MBUF_F_CLONE;
+
     // 2. 清空链表指针 (必须切断，手动重连)
     dst->next = NULL; 
     dst->next_frag = NULL;
+    dst->last_frag = NULL;
 
     // 3. 【关键】增加肉体引用计数
     // 无论是 Head 还是 Frag，只要它指向了 shared_info，就要 +1
@@ -163,10 +542,303 @@ mbuf_t *mbuf_clone(mbuf_t *head) {
         curr_src = curr_src->next_frag;
     }
 
+    new_head->last_frag = curr_dst;
     return new_head;
 }
 /* ==========================================
- * 3. 核心 API 族 (New!)
+ * 补全：按范围写时复制
+ * ========================================== */
+// 广播时每个订阅者只改几十字节的头，整包 CoW 是每人一次全包 memcpy
+// 这里只把碰到的那一段换成独占，其余继续共享
+
+// 把分片 f 数据里的 [a, b) 换成独占的；返回装着这一段的分片，段在其中的偏移：
+//   f 是 head：head 保留 [0, b) 换到新 buffer（headroom 不变），偏移仍是 a
+//   否则 a > 0：f 缩成共享的 [0, a)，后面接一个新分片装 [a, b)，偏移 0
+//   否则：f 自己换到新 buffer，偏移 0
+// [b, len) 都挂成紧跟其后的共享 clone 分片。失败返回 NULL，链保持完整
+static mbuf_t *frag_privatize(mbuf_t *pkt, mbuf_t *f, int a, int b) {
+    if (sh_writable(f->sh))
+        return f;
+
+    // 先把要的内存都拿到，拆链之后就不会再失败
+    mbuf_t *priv = NULL;
+    mbuf_shared_info_t *sh = NULL;
+    mbuf_t *suf = NULL;
+    // 换 buffer 时容量照旧；外部 buffer 可能比最大一级还大，那就只要够装 [0, b) 的
+    int cap = f->end - f->head;
+    if (cap > mbuf_rooms[MBUF_NUM_CLASSES - 1])
+        cap = (f->data - f->head) + b;
+    if (f != pkt && a > 0)
+        priv = mbuf_alloc_frag(b - a);
+    else
+        sh = sh_alloc(cap);
+    if (b < mbuf_len(f))
+        suf = __mbuf_clone_one(f);
+    if ((!priv && !sh) || (b < mbuf_len(f) && !suf)) {
+        mbuf_free_chain(priv);
+        mbuf_free_chain(suf);
+        if (sh) sh_put(sh);
+        return NULL;
+    }
+
+    if (suf) {
+        suf->data = f->data + b;
+        suf->next_frag = f->next_frag;
+        f->next_frag = suf;
+        f->tail = f->data + b;
+        if (pkt->last_frag == f)
+            pkt->last_frag = suf;
+    }
+
+    if (priv) {
+        memcpy(priv->data, f->data + a, b - a);
+        priv->tail += b - a;
+        priv->next_frag = f->next_frag;
+        f->next_frag = priv;
+        if (pkt->last_frag == f)
+            pkt->last_frag = priv;
+        f->tail = f->data + a;
+        f->end  = f->tail;          // 后面的字节归别的视图了，不能再往里追加
+        return priv;
+    }
+
+    mbuf_rebind(f, sh, b, cap);
+    return f;
+}
+
+// 保证包里 [off, off + len) 的字节独占可写，其余分片和字节照旧共享
+// 之后可以用 mbuf_cursor_write 或在分片里原地改；越界或分配失败返回 -1
+int mbuf_make_writable(mbuf_t *m, int off, int len) {
+    if (off < 0 || len < 0 || off + len > m->pkt_len) return -1;
+
+    mbuf_t *f = m;
+    while (f && off >= mbuf_len(f) && len > 0) {
+        off -= mbuf_len(f);
+        f = f->next_frag;
+    }
+    while (len > 0 && f) {
+        int n = mbuf_len(f) - off;
+        if (n > len) n = len;
+        mbuf_t *p = frag_privatize(m, f, off, off + n);
+        if (!p) return -1;
+        // 没写完说明这一段一直到分片尾，后面没拆出后缀，下一个就是原来的下一个分片
+        f = p->next_frag;
+        off = 0;
+        len -= n;
+    }
+    return 0;
+}
+
+/* ==========================================
+ * 补全：挂外部 buffer (零拷贝包装文件映射 / 共享内存 / 解密输出)
+ * ========================================== */
+// buffer 归调用者，mbuf 只引用它：shared info 从 g_ext_pool 拿，引用计数、clone、free 全照旧，
+// 最后一个引用放掉时回调（在哪个线程放就在哪个线程调）
+// mbuf 层把外部 buffer 当只读（可能是 PROT_READ 映射的文件）：要写的一律先 CoW 到 pool 里
+typedef void (*mbuf_extbuf_free_cb)(void *addr, void *opaque);
+
+// m 必须是空的（刚 alloc 的包或分片，没数据也没后续分片）：不再用原来的 buffer（home 引用照旧留着），
+// 数据换成 [ptr, ptr + len)，全部有效，没有 headroom / tailroom
+// 拿不到 info 返回 -1，这时 buffer 还归调用者，不会回调
+int mbuf_attach_extbuf(mbuf_t *m, void *ptr, int len, mbuf_extbuf_free_cb free_cb, void *opaque) {
+    assert(mbuf_len(m) == 0 && !m->next_frag);
+    mbuf_shared_info_t *sh = pool_get(&g_ext_pool);
+    if (!sh) return -1;
+    atomic_init(&sh->refcnt, 1);
+    sh->pool = &g_ext_pool;
+    sh->head = ptr;
+    sh->end = (unsigned char *)ptr + len;
+    sh->free_cb = free_cb;
+    sh->opaque = opaque;
+
+    if (m->sh && m->sh != mbuf_home(m))
+        sh_put(m->sh);
+    m->sh = sh;
+    m->head = m->data = sh->head;
+    m->tail = m->end = sh->end;
+    m->pkt_len = len;
+    return 0;
+}
+
+// 用 clone 壳包一块外部 buffer，不占 pool 里的数据 buffer；可以当包头，也可以 mbuf_append_frag 挂到别的包后面
+mbuf_t *mbuf_alloc_extbuf(void *ptr, int len, mbuf_extbuf_free_cb free_cb, void *opaque) {
+    pthread_once(&g_pools_once, mbuf_pools_init);
+    mbuf_t *m = pool_get(&g_clone_pool);
+    if (!m) return NULL;
+    m->next = m->next_frag = m->last_frag = NULL;
+    m->sh = NULL;
+    m->head = m->data = m->tail = m->end = NULL;
+    if (mbuf_attach_extbuf(m, ptr, len, free_cb, opaque) < 0) {
+        pool_put(&g_clone_pool, m);
+        return NULL;
+    }
+    return m;
+}
+
+// 把 frag 开头的一条分片链接到 head 最后，pkt_len 加上它们的长度；frag 之后归 head 管
+void mbuf_append_frag(mbuf_t *head, mbuf_t *frag) {
+    mbuf_t *last = frag;
+    for (;;) {
+        head->pkt_len += mbuf_len(last);
+        if (!last->next_frag) break;
+        last = last->next_frag;
+    }
+    mbuf_last(head)->next_frag = frag;
+    head->last_frag = last;
+}
+
+/* ==========================================
+ * 补全：批量 API (RX/TX burst)
+ * ========================================== */
+// 收发都是 32~64 个一批：一次过 pool，引用计数按 buffer 合并后一次改
+
+// free 暂存：每个 pool 攒满一批再一次性还
+typedef struct {
+    int count[MBUF_MAX_POOLS];
+    void *objs[MBUF_MAX_POOLS][MBUF_BULK_MAX];
+    mbuf_shared_info_t *sh;     // 还没扣的引用：连续几个节点指向同一块 buffer 时合并
+    int drops;
+} mbuf_stash_t;
+
+static inline void stash_obj(mbuf_stash_t *st, mbuf_pool_t *mp, void *obj) {
+    if (st->count[mp->id] == MBUF_BULK_MAX) {
+        pool_put_n(mp, st->objs[mp->id], MBUF_BULK_MAX);
+        st->count[mp->id] = 0;
+    }
+    st->objs[mp->id][st->count[mp->id]++] = obj;
+}
+
+// 一次扣掉 k 个引用；手里的就是全部引用时连原子减都省了（DPDK prefree 的做法）
+static inline void stash_settle(mbuf_stash_t *st) {
+    mbuf_shared_info_t *sh = st->sh;
+    if (!sh) return;
+    if (atomic_load_explicit(&sh->refcnt, memory_order_acquire) == st->drops ||
+        atomic_fetch_sub_explicit(&sh->refcnt, st->drops, memory_order_acq_rel) == st->drops)
+        stash_obj(st, sh->pool, sh_release(sh));
+    st->sh = NULL;
+}
+
+static inline void stash_drop(mbuf_stash_t *st, mbuf_shared_info_t *sh) {
+    if (st->sh != sh) {
+        stash_settle(st);
+        st->sh = sh;
+        st->drops = 0;
+    }
+    st->drops++;
+}
+
+static void stash_flush(mbuf_stash_t *st) {
+    stash_settle(st);
+    for (int i = 0; i < MBUF_MAX_POOLS; i++) {
+        if (st->count[i] > 0)
+            pool_put_n(g_pools_by_id[i], st->objs[i], st->count[i]);
+    }
+}
+
+// 释放 n 个包（各自带分片链）；NULL 跳过
+void mbuf_free_bulk(mbuf_t **pkts, int n) {
+    mbuf_stash_t st;
+    memset(st.count, 0, sizeof(st.count));
+    st.sh = NULL;
+
+    for (int i = 0; i < n; i++) {
+        if (i + 1 < n && pkts[i + 1])
+            __builtin_prefetch(pkts[i + 1]);
+        for (mbuf_t *m = pkts[i], *next; m; m = next) {
+            next = m->next_frag;
+            if (next)
+                __builtin_prefetch(next);
+
+            // 和 mbuf_free_one 一样：先放 buffer 的引用，再放自带的 home / clone 壳
+            mbuf_shared_info_t *home = mbuf_home(m);
+            if (m->sh != home)
+                stash_drop(&st, m->sh);
+            if (home)
+                stash_drop(&st, home);
+            else
+                stash_obj(&st, &g_clone_pool, m);
+        }
+    }
+    stash_flush(&st);
+}
+
+// 一次分配 n 个同样大小的包；不够 n 个时一个都不给，返回 -1
+int mbuf_alloc_bulk(int payload_size, mbuf_t **pkts, int n) {
+    mbuf_pool_t *mp = pool_for_room(payload_size + MBUF_HEADROOM);
+    if (!mp) return -1;
+
+    for (int done = 0; done < n; ) {
+        int k = n - done < MBUF_BULK_MAX ? n - done : MBUF_BULK_MAX;
+        if (pool_get_n(mp, (void **)&pkts[done], k) < 0) {
+            mbuf_free_bulk(pkts, done);
+            return -1;
+        }
+        for (int i = 0; i < k; i++) {
+            // 提前把后两个的 mbuf_t 和 sh 拉进来，初始化时就不用等 cache miss
+            if (i + 2 < k) {
+                __builtin_prefetch(pkts[done + i + 2], 1);
+                __builtin_prefetch(mbuf_home_sh(pkts[done + i + 2]), 1);
+            }
+            mbuf_reset(pkts[done + i], MBUF_HEADROOM, payload_size);
+        }
+        done += k;
+    }
+    return 0;
+}
+
+// 同一个包克隆 n 份（组播 / 泛洪）：每个分片的引用计数只加一次 n
+// 不够时一份都不给，返回 -1
+int mbuf_clone_bulk(mbuf_t *head, mbuf_t **clones, int n) {
+    if (!head || n <= 0) return -1;
+    pthread_once(&g_pools_once, mbuf_pools_init);
+
+    int left = 0;
+    for (mbuf_t *m = head; m; m = m->next_frag)
+        left++;
+    left *= n;
+
+    // 壳一批批拿，依次分给各份 clone 的各个分片
+    void *objs[MBUF_BULK_MAX];
+    int got = 0;
+    for (int i = 0; i < n; i++) {
+        mbuf_t **link = &clones[i], *last = NULL;
+        for (mbuf_t *src = head; src; src = src->next_frag) {
+            if (got == 0) {
+                int want = left < MBUF_BULK_MAX ? left : MBUF_BULK_MAX;
+                if (pool_get_n(&g_clone_pool, objs, want) < 0) {
+                    // 引用还没加，已经建好的只还壳
+                    *link = NULL;
+                    for (int k = 0; k <= i; k++) {
+                        for (mbuf_t *m = clones[k], *next; m; m = next) {
+                            next = m->next_frag;
+                            pool_put(&g_clone_pool, m);
+                        }
+                    }
+                    return -1;
+                }
+                got = want;
+            }
+            mbuf_t *dst = objs[--got];
+            left--;
+            *dst = *src;
+            dst->flags |= MBUF_F_CLONE;
+            dst->next = NULL;
+            dst->next_frag = NULL;
+            dst->last_frag = NULL;
+            *link = dst;
+            link = &dst->next_frag;
+            last = dst;
+        }
+        clones[i]->last_frag = last;
+    }
+
+    for (mbuf_t *src = head; src; src = src->next_frag)
+        atomic_fetch_add_explicit(&src->sh->refcnt, n, memory_order_relaxed);
+    return 0;
+}
+
+/* ==========================================
+ * 4. 核心 API 族 (New!)
  * ========================================== */
 
 // ---------------------------------------------------------
@@ -231,20 +903,85 @@ void *mbuf_header_pointer(mbuf_t *m, int offset, int len, void *buffer) {
     return buffer;
 }
 
+// 摘掉并释放 head 后面紧跟的那个分片
+static void mbuf_unlink_next(mbuf_t *m) {
+    mbuf_t *f = m->next_frag;
+    m->next_frag = f->next_frag;
+    if (m->last_frag == f)
+        m->last_frag = m;
+    f->next_frag = NULL;
+    mbuf_free_chain(f);
+}
+
+// ---------------------------------------------------------
+// [API 6] mbuf_linearize: 把前 len 字节收进 head 分片 (pskb_may_pull)
+// 成功后 m->data 起的 len 字节连续，协议头可以原地读；要改的话再 mbuf_make_writable
+// ---------------------------------------------------------
+int mbuf_linearize(mbuf_t *m, int len) {
+    if (len <= mbuf_len(m)) return 0;
+    if (len > m->pkt_len) return -1;
+
+    int need = len - mbuf_len(m);
+    if (mbuf_tailroom(m) < need || !sh_writable(m->sh)) {
+        if (mbuf_realloc(m, need) < 0)
+            return -1;
+    }
+
+    // 从后面的分片往 head 尾部搬；分片只是前移 data，共享的 buffer 不动
+    while (need > 0) {
+        mbuf_t *f = m->next_frag;
+        int n = need < mbuf_len(f) ? need : mbuf_len(f);
+        memcpy(m->tail, f->data, n);
+        m->tail += n;
+        f->data += n;
+        need -= n;
+        if (mbuf_len(f) == 0)
+            mbuf_unlink_next(m);
+    }
+    return 0;
+}
+
 // ---------------------------------------------------------
 // [API 3] skb_pull: 头部剥离 (用于解析协议)
 // ---------------------------------------------------------
 void *mbuf_pull(mbuf_t *m, int len) {
-    // 这里简化处理，通常 skb_pull 只允许 pull 线性区(frag[0])的数据
-    // 如果要 pull 的数据跨分片了，内核会调用 __pskb_pull_tail 先把数据这一部分线性化
-    
-    if (len > mbuf_len(m)) {
-        printf("[Pull Error] Cannot pull %d bytes (frag len %d)\n", len, mbuf_len(m));
+    // skb_pull 只动线性区(frag[0])；跨分片时 head 整个剥掉，再从后面的分片里吃，吃空的摘掉
+    if (len > m->pkt_len) {
+        printf("[Pull Error] Cannot pull %d bytes (pkt len %d)\n", len, m->pkt_len);
         return NULL;
     }
-    
-    m->data += len;
+
+    int eat = len - mbuf_len(m);
+    if (eat <= 0) {
+        m->data += len;
+        m->pkt_len -= len;
+        return m->data;
+    }
+
+    m->data = m->tail;
     m->pkt_len -= len;
+    while (eat > 0) {
+        mbuf_t *f = m->next_frag;
+        int n = eat < mbuf_len(f) ? eat : mbuf_len(f);
+        f->data += n;
+        eat -= n;
+        if (mbuf_len(f) == 0)
+            mbuf_unlink_next(m);
+    }
+    // head 空了就直接改看下一个分片的 buffer（多拿一个引用），把那个分片摘掉：不拷数据
+    // 返回的指针只保证到这个分片末尾连续，要更长的调用者自己 mbuf_linearize
+    mbuf_t *f = m->next_frag;
+    if (f) {
+        atomic_fetch_add(&f->sh->refcnt, 1);
+        if (m->sh != mbuf_home(m))
+            sh_put(m->sh);
+        m->sh   = f->sh;
+        m->head = f->head;
+        m->data = f->data;
+        m->tail = f->tail;
+        m->end  = f->end;
+        mbuf_unlink_next(m);
+    }
     return m->data;
 }
 
@@ -268,6 +1005,7 @@ int mbuf_trim(mbuf_t *m, int new_len) {
             // 释放后续所有 frags
             mbuf_free_chain(curr->next_frag);
             curr->next_frag = NULL;
+            m->last_frag = curr;
             
             m->pkt_len = new_len;
             return 0;
@@ -282,69 +1020,1572 @@ int mbuf_trim(mbuf_t *m, int new_len) {
     return 0;
 }
 
-/* ==========================================
- * 4. 场景演示
- * ========================================== */
+// ---------------------------------------------------------
+// [API 5] mbuf_cursor: 顺序读写游标
+// 记住当前分片和分片内偏移，逐字段解析长链时不再每次从头找，整体线性
+// 用游标期间不要增删分片
+// ---------------------------------------------------------
+typedef struct {
+    mbuf_t *pkt;    // head，往回 seek 时从这里重来
+    mbuf_t *frag;   // 当前分片，NULL 表示到了包尾
+    int off;        // 在当前分片数据里的偏移
+    int pos;        // 在整个包里的偏移
+} mbuf_cursor_t;
 
-void dump_full(mbuf_t *m, const char *msg) {
-    printf("\n--- %s (Total: %d) ---\n", msg, m->pkt_len);
-    int idx = 0;
-    mbuf_t *curr = m;
-    while(curr) {
-        printf("Frag %d: [", idx++);
-        for (unsigned char *p = curr->data; p < curr->tail; p++) printf("%02X ", *p);
-        printf("]\n");
-        curr = curr->next_frag;
+// 走到分片末尾就挪到下一个分片开头，顺便跳过空分片
+static inline void cursor_settle(mbuf_cursor_t *c) {
+    while (c->frag && c->off == mbuf_len(c->frag)) {
+        c->frag = c->frag->next_frag;
+        c->off = 0;
     }
 }
 
-int main() {
-    // 1. 构造一个跨分片的包
-    // Frag 0: 4 bytes (Headroom 128)
-    mbuf_t *pkt = mbuf_alloc(4); 
-    uint8_t part1[] = {0xAA, 0xBB, 0xCC, 0xDD};
-    mbuf_append_large(pkt, part1, 4);
+static inline int mbuf_cursor_pos(const mbuf_cursor_t *c) { return c->pos; }
 
-    // Frag 1: 4 bytes (自动分配)
-    uint8_t part2[] = {0x11, 0x22, 0x33, 0x44};
-    mbuf_append_large(pkt, part2, 4);
+void mbuf_cursor_init(mbuf_cursor_t *c, mbuf_t *m) {
+    c->pkt = m;
+    c->frag = m;
+    c->off = 0;
+    c->pos = 0;
+    cursor_settle(c);
+}
 
-    dump_full(pkt, "Initial Packet");
-    // Memory: [AA BB CC DD] -> [11 22 33 44]
+// 前移 len 字节；不够返回 -1，游标停在包尾
+int mbuf_cursor_skip(mbuf_cursor_t *c, int len) {
+    while (len > 0 && c->frag) {
+        int avail = mbuf_len(c->frag) - c->off;
+        int n = len < avail ? len : avail;
+        c->off += n;
+        c->pos += n;
+        len -= n;
+        cursor_settle(c);
+    }
+    return len > 0 ? -1 : 0;
+}
 
-    // -------------------------------------------------
-    // 测试 1: skb_copy_bits (全量导出)
-    // -------------------------------------------------
-    uint8_t full_copy[8];
-    mbuf_copy_bits(pkt, 0, full_copy, 8);
-    printf("\n[Test CopyBits] %02X %02X ... %02X\n", full_copy[0], full_copy[1], full_copy[7]);
+// 往后直接前移，往回才从 head 重新数
+int mbuf_cursor_seek(mbuf_cursor_t *c, int pos) {
+    if (pos < c->pos)
+        mbuf_cursor_init(c, c->pkt);
+    return mbuf_cursor_skip(c, pos - c->pos);
+}
 
-    // -------------------------------------------------
-    // 测试 2: skb_pull (剥离头部 2 字节)
-    // -------------------------------------------------
-    mbuf_pull(pkt, 2); 
-    dump_full(pkt, "After Pull(2)");
-    // Memory: [CC DD] -> [11 22 33 44] (Total 6)
+// 拷出 len 字节并前移；不够返回 -1
+int mbuf_cursor_read(mbuf_cursor_t *c, void *to, int len) {
+    unsigned char *dst = to;
+    while (len > 0 && c->frag) {
+        int avail = mbuf_len(c->frag) - c->off;
+        int n = len < avail ? len : avail;
+        memcpy(dst, c->frag->data + c->off, n);
+        dst += n;
+        c->off += n;
+        c->pos += n;
+        len -= n;
+        cursor_settle(c);
+    }
+    return len > 0 ? -1 : 0;
+}
 
-    // -------------------------------------------------
-    // 测试 3: skb_header_pointer (跨分片读取)
-    // -------------------------------------------------
-    // 现在 pkt 开头是 CC DD。
-    // 我们想读 offset=1 开始的 4 个字节 (即 DD 11 22 33)
-    // 这跨越了 Frag0 (只剩 DD) 和 Frag1 (11 22 33 ...)
-    uint8_t scratch[4];
-    void *ptr = mbuf_header_pointer(pkt, 1, 4, scratch);
-    
-    printf("\n[Test SmartPtr] Reading 4 bytes at offset 1:\n");
-    if (ptr == scratch) printf("-> Type: Slow Path (Copied)\n");
-    else printf("-> Type: Fast Path (Direct)\n");
-    
-    uint8_t *p = (uint8_t *)ptr;
-    printf("-> Data: %02X %02X %02X %02X (Expect: DD 11 22 33)\n", p[0], p[1], p[2], p[3]);
+// 游标版 header_pointer：在一个分片里就直接给指针，跨分片才拼进 buf；都会前移
+void *mbuf_cursor_ptr(mbuf_cursor_t *c, int len, void *buf) {
+    if (c->frag && mbuf_len(c->frag) - c->off >= len) {
+        void *p = c->frag->data + c->off;
+        c->off += len;
+        c->pos += len;
+        cursor_settle(c);
+        return p;
+    }
+    return mbuf_cursor_read(c, buf, len) < 0 ? NULL : buf;
+}
 
-    // -------------------------------------------------
-    // 测试 4: skb_trim (剪裁到总长 3)
-    // -------------------------------------------------
+// 覆盖已有的 len 字节并前移，共享的分片只 CoW 写到的那段；不够或分配失败返回 -1
+int mbuf_cursor_write(mbuf_cursor_t *c, const void *from, int len) {
+    const unsigned char *src = from;
+    while (len > 0 && c->frag) {
+        int avail = mbuf_len(c->frag) - c->off;
+        int n = len < avail ? len : avail;
+        // 只把要写的这段换成独占；可能换到新拆出来的分片上
+        mbuf_t *p = frag_privatize(c->pkt, c->frag, c->off, c->off + n);
+        if (!p) return -1;
+        if (p != c->frag) {
+            c->frag = p;
+            c->off = 0;
+        }
+        memcpy(c->frag->data + c->off, src, n);
+        src += n;
+        c->off += n;
+        c->pos += n;
+        len -= n;
+        cursor_settle(c);
+    }
+    return len > 0 ? -1 : 0;
+}
+
+/* ==========================================
+ * 补全：校验和 (RFC 1071 反码和 / CRC32C)
+ * ========================================== */
+// 沿分片链一段段算，不 linearize 也不拷；按 CPU 选内核：AVX2 / SSE4.2，都没有走标量
+// 反码和跟字节序无关：按本机序加 16 位字，算出来的值原样写回报文就对
+// 某段从包里的奇数偏移开始时，它的和要把两个字节对调再并进来（RFC 1071 的 byte swap 性质）
+#define CRC32C_POLY 0x82F63B78u     // Castagnoli，反射形式
+
+typedef uint64_t (*csum_kernel_t)(const unsigned char *p, size_t len);
+typedef uint32_t (*crc_kernel_t)(uint32_t crc, const unsigned char *p, size_t len);
+
+static pthread_once_t g_csum_once = PTHREAD_ONCE_INIT;
+static uint32_t g_crc32c_table[8][256];
+static csum_kernel_t g_csum_kernel;
+static crc_kernel_t g_crc_kernel;
+static const char *g_csum_impl, *g_crc_impl;
+
+// 32 位字累加进 64 位，2^32 个字以内不会溢出；和 16 位字的反码和同余（2^16 ≡ 1 mod 0xffff）
+// 最后剩一个字节时当成后面补 0 的 16 位字，按内存顺序
+static uint64_t csum_scalar(const unsigned char *p, size_t len) {
+    uint64_t sum = 0;
+    uint32_t a, b;
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&a, p, 4);
+        memcpy(&b, p + 4, 4);
+        sum += (uint64_t)a + b;
+    }
+    if (len >= 4) {
+        memcpy(&a, p, 4);
+        sum += a;
+        p += 4;
+        len -= 4;
+    }
+    uint16_t w = 0;
+    if (len >= 2) {
+        memcpy(&w, p, 2);
+        sum += w;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        w = 0;
+        memcpy(&w, p, 1);
+        sum += w;
+    }
+    return sum;
+}
+
+static inline uint16_t csum_fold(uint64_t sum) {
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
+
+static inline uint16_t csum_swab(uint16_t s) { return (uint16_t)(s << 8 | s >> 8); }
+
+static uint32_t crc32c_scalar(uint32_t crc, const unsigned char *p, size_t len) {
+    const uint32_t (*t)[256] = g_crc32c_table;
+    // slice-by-8：一次吃 8 字节，8 张表各查一次（按小端取字）
+    if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) {
+        for (; len >= 8; p += 8, len -= 8) {
+            uint32_t lo, hi;
+            memcpy(&lo, p, 4);
+            memcpy(&hi, p + 4, 4);
+            lo ^= crc;
+            crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+                  t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        }
+    }
+    for (; len; p++, len--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__)
+// 每 32 字节拆成 8 个 32 位字零扩展到 64 位累加；两个累加器错开依赖链
+__attribute__((target("avx2")))
+static uint64_t csum_avx2(const unsigned char *p, size_t len) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+    for (; len >= 64; p += 64, len -= 64) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + csum_scalar(p, len);
+}
+
+// crc32 指令一次 8 字节
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (uint32_t)c;
+    for (; len; p++, len--)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+#endif
+
+static void csum_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        g_crc32c_table[0][i] = c;
+    }
+    for (int t = 1; t < 8; t++)
+        for (int i = 0; i < 256; i++)
+            g_crc32c_table[t][i] = (g_crc32c_table[t - 1][i] >> 8) ^
+                                   g_crc32c_table[0][g_crc32c_table[t - 1][i] & 0xff];
+
+    g_csum_kernel = csum_scalar;
+    g_crc_kernel = crc32c_scalar;
+    g_csum_impl = g_crc_impl = "scalar";
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        g_csum_kernel = csum_avx2;
+        g_csum_impl = "avx2";
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        g_crc_kernel = crc32c_sse42;
+        g_crc_impl = "sse4.2";
+    }
+#endif
+}
+
+// [off, off + len) 的反码和，未取反，接在 sum 后面（sum 对应的数据要在偶数偏移结束）
+// 结果可以继续累加，也可以交给 csum_fold；范围不能超过包长
+uint32_t mbuf_csum_partial(mbuf_t *m, int off, int len, uint32_t sum) {
+    pthread_once(&g_csum_once, csum_init);
+    assert(off >= 0 && len >= 0 && off + len <= m->pkt_len);
+
+    uint64_t acc = sum;
+    int pos = 0;                // 已经加过的字节数，奇数时下一段要对调
+    for (mbuf_t *f = m; f && len > 0; f = f->next_frag) {
+        if (off >= mbuf_len(f)) {
+            off -= mbuf_len(f);
+            continue;
+        }
+        int n = mbuf_len(f) - off < len ? mbuf_len(f) - off : len;
+        uint16_t s = csum_fold(g_csum_kernel(f->data + off, n));
+        acc += (pos & 1) ? csum_swab(s) : s;
+        pos += n;
+        len -= n;
+        off = 0;
+    }
+    return csum_fold(acc);
+}
+
+// RFC 1071 校验和：直接写进报头；对带着校验和字段的整段再算一遍，结果为 0 就是对的
+uint16_t mbuf_csum(mbuf_t *m, int off, int len) {
+    return ~mbuf_csum_partial(m, off, len, 0) & 0xffff;
+}
+
+// CRC32C（iSCSI / SCTP / 各种隧道封装用的那个），初值和结果都按惯例取反
+uint32_t mbuf_crc32c(mbuf_t *m, int off, int len) {
+    pthread_once(&g_csum_once, csum_init);
+    assert(off >= 0 && len >= 0 && off + len <= m->pkt_len);
+
+    uint32_t crc = ~0u;
+    for (mbuf_t *f = m; f && len > 0; f = f->next_frag) {
+        if (off >= mbuf_len(f)) {
+            off -= mbuf_len(f);
+            continue;
+        }
+        int n = mbuf_len(f) - off < len ? mbuf_len(f) - off : len;
+        crc = g_crc_kernel(crc, f->data + off, n);
+        len -= n;
+        off = 0;
+    }
+    return ~crc;
+}
+
+// 增量更新（RFC 1624：HC' = ~(~HC + ~m + m')）：报头里一个 16 / 32 位字段从 from 改成 to，
+// 原地改存着的校验和；所有值都按报文里的字节序传（直接从报头里读出来的那个）
+static inline void csum_replace2(uint16_t *csum, uint16_t from, uint16_t to) {
+    *csum = ~csum_fold((uint64_t)(uint16_t)~*csum + (uint16_t)~from + to);
+}
+
+static inline void csum_replace4(uint16_t *csum, uint32_t from, uint32_t to) {
+    *csum = ~csum_fold((uint64_t)(uint16_t)~*csum + (uint32_t)~from + to);
+}
+
+// 剥掉 len 字节，同时从 *csum 里减掉这些字节（*csum 是对包里现有数据的反码和，
+// 比如收包时网卡给的整包和），不用对剩下的数据重算；len 是奇数时剩下的数据奇偶翻转，结果对调字节
+void *mbuf_pull_rcsum(mbuf_t *m, int len, uint32_t *csum) {
+    if (len > m->pkt_len)
+        return mbuf_pull(m, len);       // 让 mbuf_pull 报错
+    uint16_t pulled = mbuf_csum_partial(m, 0, len, 0);
+    void *p = mbuf_pull(m, len);
+    uint16_t rest = csum_fold((uint64_t)*csum + (uint16_t)~pulled);
+    *csum = (len & 1) ? csum_swab(rest) : rest;
+    return p;
+}
+
+/* ==========================================
+ * 补全：软件分段 / 合并 (GSO / GRO)
+ * ========================================== */
+// 上层按 64KB 的大包处理，出口再切成 MSS 大小；入口把同一条流连续的小包并回大包
+// 两个方向都不拷负载：分段时负载是原分片的 clone 视图，合并时把后一个包的分片直接挂过去
+// 协议字段（长度、序号、校验和）这里不懂，由调用者按段改（csum_replace* 可以用上）
+
+// 大包切成负载最多 mss 字节的若干包，用 next 串起来返回；原包不动，调用者自己放
+// 每段的头是前 hdr_len 字节的独立拷贝，在 head 里连续可写；失败返回 NULL，切出来的都放掉
+mbuf_t *mbuf_segment(mbuf_t *m, int mss, int hdr_len) {
+    if (mss <= 0 || hdr_len < 0 || hdr_len > m->pkt_len)
+        return NULL;
+
+    // 找到负载开始的分片
+    mbuf_t *f = m;
+    int off = hdr_len;
+    while (f && off >= mbuf_len(f)) {
+        off -= mbuf_len(f);
+        f = f->next_frag;
+    }
+
+    mbuf_t *first = NULL, **link = &first;
+    int payload = m->pkt_len - hdr_len;
+    do {
+        int seg_len = payload < mss ? payload : mss;
+        mbuf_t *seg = mbuf_alloc(hdr_len);
+        if (!seg) goto fail;
+        *link = seg;
+        link = &seg->next;
+        mbuf_copy_bits(m, 0, seg->tail, hdr_len);
+        seg->tail += hdr_len;
+        seg->pkt_len = hdr_len;
+
+        mbuf_t *last = seg;
+        for (int left = seg_len; left > 0; ) {
+            int n = mbuf_len(f) - off;
+            if (n > left) n = left;
+            if (n > 0) {
+                mbuf_t *v = __mbuf_clone_one(f);
+                if (!v) goto fail;
+                v->data = f->data + off;
+                v->tail = v->data + n;
+                last->next_frag = v;
+                last = v;
+                seg->pkt_len += n;
+                left -= n;
+                off += n;
+            }
+            if (off == mbuf_len(f)) {
+                f = f->next_frag;
+                off = 0;
+            }
+        }
+        seg->last_frag = last;
+        payload -= seg_len;
+    } while (payload > 0);
+    return first;
+
+fail:
+    while (first) {
+        mbuf_t *next = first->next;
+        mbuf_free_chain(first);
+        first = next;
+    }
+    return NULL;
+}
+
+// b 能不能接在 merged 后面：同一条流、序号正好接上之类，协议相关由调用者判断
+// 返回 true 之前可以顺手改 merged 的头（比如总长度），合并一定会发生
+typedef bool (*mbuf_gro_match_t)(mbuf_t *merged, mbuf_t *b, void *arg);
+
+// 把 pkts 里相邻、match 认可的包并成一条链：后一个剥掉 hdr_len 字节的头，剩下的分片挂到前一个后面
+// 合并后不超过 max_len；原地压紧 pkts，返回剩下的包数
+int mbuf_coalesce(mbuf_t **pkts, int n, int hdr_len, int max_len,
+                  mbuf_gro_match_t match, void *arg) {
+    int out = 0;
+    for (int i = 0; i < n; i++) {
+        mbuf_t *b = pkts[i];
+        mbuf_t *a = out ? pkts[out - 1] : NULL;
+        if (!a || b->pkt_len <= hdr_len || a->pkt_len + b->pkt_len - hdr_len > max_len ||
+            !match(a, b, arg)) {
+            pkts[out++] = b;
+            continue;
+        }
+        // 剥头只前移分片的 data，不拷负载；剥空的分片（包括 head）直接放掉，只挂带负载的
+        // 上面保证了 pkt_len > hdr_len，走不到链尾
+        b->next = NULL;
+        int eat = hdr_len;
+        while (mbuf_len(b) <= eat) {
+            mbuf_t *rest = b->next_frag;
+            eat -= mbuf_len(b);
+            b->next_frag = NULL;
+            mbuf_free_one(b);
+            b = rest;
+        }
+        b->data += eat;
+        mbuf_append_frag(a, b);
+    }
+    return out;
+}
+
+/* ==========================================
+ * 补全：无锁 mbuf ring (rte_ring 风格)
+ * ========================================== */
+// 流水线各级之间传包：2 的幂个槽放 mbuf 指针，生产者、消费者各一对 head/tail，各占一条 cache line
+// 放/取都分两步：先推 head 占位（多生产者/多消费者用 CAS 抢），拷指针，再推 tail 发布
+// 多个生产者同时占了位时，tail 严格按占位顺序前进，后占的要等前面的先发布
+// head/tail 是自由增长的 32 位计数，差值就是元素数，回绕不用管
+#define MBUF_RING_SP_ENQ  (1 << 0)      // 只有一个生产者：head 直接写，不 CAS，也不用等 tail
+#define MBUF_RING_SC_DEQ  (1 << 1)      // 只有一个消费者
+#define MBUF_RING_SPSC    (MBUF_RING_SP_ENQ | MBUF_RING_SC_DEQ)
+#define MBUF_RING_MPSC    MBUF_RING_SC_DEQ
+#define MBUF_RING_MPMC    0
+
+struct mbuf_ring;
+enum mbuf_ring_event { MBUF_RING_WM_HIGH, MBUF_RING_WM_LOW };
+// 越过水位时在放/取的那个线程里调，用来做背压（停上游）或恢复；并发时水位是近似的
+typedef void (*mbuf_ring_wm_cb)(struct mbuf_ring *r, enum mbuf_ring_event ev, void *arg);
+
+struct mbuf_ring_headtail {
+    atomic_uint head;           // 下一个要占的位置
+    atomic_uint tail;           // 这之前的对另一端可见
+} __attribute__((aligned(CACHE_LINE)));
+
+typedef struct mbuf_ring {
+    unsigned size, mask;
+    int flags;
+    unsigned wm_high;           // 放完后元素数从下面涨到 >= wm_high 时回调，0 不用
+    unsigned wm_low;            // 取完后元素数从上面掉到 <= wm_low 时回调
+    mbuf_ring_wm_cb wm_cb;
+    void *wm_arg;
+    struct mbuf_ring_headtail prod;
+    struct mbuf_ring_headtail cons;
+    mbuf_t *slots[] __attribute__((aligned(CACHE_LINE)));
+} mbuf_ring_t;
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// 等前面占了位的先发布；那个线程被抢占了的话干转没用（核比线程少时很常见），转一阵就让出
+static inline void ring_wait_tail(atomic_uint *tail, unsigned expect) {
+    for (unsigned spins = 0; atomic_load_explicit(tail, memory_order_relaxed) != expect; spins++) {
+        if (spins < 1024)
+            cpu_relax();
+        else
+            sched_yield();
+    }
+}
+
+// count 必须是 2 的幂，能装满 count 个；剩在里面的包 mbuf_ring_free 不管
+mbuf_ring_t *mbuf_ring_create(unsigned count, int flags) {
+    if (count == 0 || (count & (count - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size_t bytes = ALIGN_UP(sizeof(mbuf_ring_t) + count * sizeof(mbuf_t *), CACHE_LINE);
+    mbuf_ring_t *r = aligned_alloc(CACHE_LINE, bytes);
+    if (!r) return NULL;
+    memset(r, 0, sizeof(*r));
+    r->size = count;
+    r->mask = count - 1;
+    r->flags = flags;
+    return r;
+}
+
+void mbuf_ring_free(mbuf_ring_t *r) { free(r); }
+
+void mbuf_ring_set_watermark(mbuf_ring_t *r, unsigned high, unsigned low,
+                             mbuf_ring_wm_cb cb, void *arg) {
+    r->wm_high = high;
+    r->wm_low = low;
+    r->wm_arg = arg;
+    r->wm_cb = cb;
+}
+
+static inline unsigned mbuf_ring_count(mbuf_ring_t *r) {
+    return atomic_load_explicit(&r->prod.tail, memory_order_acquire) -
+           atomic_load_explicit(&r->cons.tail, memory_order_acquire);
+}
+
+static inline unsigned mbuf_ring_free_count(mbuf_ring_t *r) {
+    return r->size - mbuf_ring_count(r);
+}
+
+// fixed：放不下 n 个就一个都不放（bulk）；否则能放几个放几个（burst）
+static unsigned ring_enqueue(mbuf_ring_t *r, mbuf_t *const *pkts, unsigned n, bool fixed) {
+    bool single = r->flags & MBUF_RING_SP_ENQ;
+    unsigned head = atomic_load_explicit(&r->prod.head, memory_order_acquire);
+    unsigned k, used;
+    for (;;) {
+        // cons.tail 用 acquire：消费者拿走了的槽才能覆盖
+        used = head - atomic_load_explicit(&r->cons.tail, memory_order_acquire);
+        k = n;
+        if (k > r->size - used)
+            k = fixed ? 0 : r->size - used;
+        if (!k) return 0;
+        if (single) {
+            atomic_store_explicit(&r->prod.head, head + k, memory_order_relaxed);
+            break;
+        }
+        if (atomic_compare_exchange_weak_explicit(&r->prod.head, &head, head + k,
+                                                  memory_order_acquire, memory_order_acquire))
+            break;
+    }
+
+    for (unsigned i = 0; i < k; i++)
+        r->slots[(head + i) & r->mask] = pkts[i];
+    if (!single)
+        ring_wait_tail(&r->prod.tail, head);
+    atomic_store_explicit(&r->prod.tail, head + k, memory_order_release);
+
+    if (r->wm_high && used < r->wm_high && used + k >= r->wm_high)
+        r->wm_cb(r, MBUF_RING_WM_HIGH, r->wm_arg);
+    return k;
+}
+
+static unsigned ring_dequeue(mbuf_ring_t *r, mbuf_t **pkts, unsigned n, bool fixed) {
+    bool single = r->flags & MBUF_RING_SC_DEQ;
+    unsigned head = atomic_load_explicit(&r->cons.head, memory_order_acquire);
+    unsigned k, avail;
+    for (;;) {
+        // prod.tail 用 acquire：看得到 tail 就看得到槽里的指针
+        avail = atomic_load_explicit(&r->prod.tail, memory_order_acquire) - head;
+        k = n;
+        if (k > avail)
+            k = fixed ? 0 : avail;
+        if (!k) return 0;
+        if (single) {
+            atomic_store_explicit(&r->cons.head, head + k, memory_order_relaxed);
+            break;
+        }
+        if (atomic_compare_exchange_weak_explicit(&r->cons.head, &head, head + k,
+                                                  memory_order_acquire, memory_order_acquire))
+            break;
+    }
+
+    for (unsigned i = 0; i < k; i++)
+        pkts[i] = r->slots[(head + i) & r->mask];
+    if (!single)
+        ring_wait_tail(&r->cons.tail, head);
+    atomic_store_explicit(&r->cons.tail, head + k, memory_order_release);
+
+    if (r->wm_low && avail > r->wm_low && avail - k <= r->wm_low)
+        r->wm_cb(r, MBUF_RING_WM_LOW, r->wm_arg);
+    return k;
+}
+
+// 全放进去返回 n，放不下返回 0
+unsigned mbuf_ring_enqueue_bulk(mbuf_ring_t *r, mbuf_t *const *pkts, unsigned n) {
+    return ring_enqueue(r, pkts, n, true);
+}
+
+// 返回放进去的个数，剩下的还归调用者
+unsigned mbuf_ring_enqueue_burst(mbuf_ring_t *r, mbuf_t *const *pkts, unsigned n) {
+    return ring_enqueue(r, pkts, n, false);
+}
+
+unsigned mbuf_ring_dequeue_bulk(mbuf_ring_t *r, mbuf_t **pkts, unsigned n) {
+    return ring_dequeue(r, pkts, n, true);
+}
+
+unsigned mbuf_ring_dequeue_burst(mbuf_ring_t *r, mbuf_t **pkts, unsigned n) {
+    return ring_dequeue(r, pkts, n, false);
+}
+
+static inline int mbuf_ring_enqueue(mbuf_ring_t *r, mbuf_t *m) {
+    return ring_enqueue(r, &m, 1, true) ? 0 : -1;
+}
+
+// 空的返回 NULL
+static inline mbuf_t *mbuf_ring_dequeue(mbuf_ring_t *r) {
+    mbuf_t *m;
+    return ring_dequeue(r, &m, 1, true) ? m : NULL;
+}
+
+/* ==========================================
+ * 补全：socket 收发 (scatter-gather / 批量 / MSG_ZEROCOPY)
+ * ========================================== */
+// 分片直接铺成 iovec 交给内核：多分片的包发出去不用 linearize，也不多拷一次
+// 只管已 connect 的 socket，不带地址
+#define MBUF_IOV_MAX    64                      // 一个包最多这么多个非空分片，再多返回 EMSGSIZE
+#define MBUF_MMSG_MAX   MBUF_BULK_MAX           // *mmsg 一次 syscall 最多这么多个包
+#define MBUF_MMSG_IOV   (4 * MBUF_MMSG_MAX)     // 一批共用的 iovec 数
+#define MBUF_ZC_SLOTS   256                     // MSG_ZEROCOPY 在途 send 次数上限
+
+// 发送用：每个非空分片一项；超过 max 项返回 -1
+static int mbuf_tx_iov(mbuf_t *m, struct iovec *iov, int max) {
+    int n = 0;
+    for (mbuf_t *f = m; f; f = f->next_frag) {
+        if (mbuf_len(f) == 0) continue;
+        if (n == max) return -1;
+        iov[n].iov_base = f->data;
+        iov[n].iov_len  = mbuf_len(f);
+        n++;
+    }
+    return n;
+}
+
+// 接收用：备一条能装 size 字节的空链，iovec 铺在各分片的 tailroom 上
+// head 留 headroom，后面的分片按剩余长度要（最大一级封顶）；iovec 不够或分配失败返回 NULL
+static mbuf_t *mbuf_rx_prepare(int size, struct iovec *iov, int max, int *niov) {
+    int top = mbuf_rooms[MBUF_NUM_CLASSES - 1];
+    int first = size < top - MBUF_HEADROOM ? size : top - MBUF_HEADROOM;
+    if (max < 1) return NULL;
+    mbuf_t *m = mbuf_alloc(first);
+    if (!m) return NULL;
+
+    mbuf_t *last = m;
+    int n = 0, rem = size;
+    for (mbuf_t *f = m; ; ) {
+        iov[n].iov_base = f->tail;
+        iov[n].iov_len  = mbuf_tailroom(f);
+        rem -= mbuf_tailroom(f);
+        n++;
+        if (rem <= 0) break;
+        if (n == max || !(f = mbuf_alloc_frag(rem < top ? rem : top))) {
+            mbuf_free_chain(m);
+            return NULL;
+        }
+        last->next_frag = f;
+        last = f;
+    }
+    m->last_frag = last;
+    *niov = n;
+    return m;
+}
+
+// 收到 len 字节：按顺序填满各分片，没用上的分片还回去
+static void mbuf_rx_commit(mbuf_t *m, int len) {
+    mbuf_t *last = m;
+    m->pkt_len = len;
+    for (mbuf_t *f = m; f && len > 0; f = f->next_frag) {
+        int n = len < mbuf_tailroom(f) ? len : mbuf_tailroom(f);
+        f->tail += n;
+        len -= n;
+        last = f;
+    }
+    mbuf_free_chain(last->next_frag);
+    last->next_frag = NULL;
+    m->last_frag = last;
+}
+
+// 整条链一次 sendmsg，返回值同 sendmsg；包不释放
+// 流式 socket 只发出去一部分时，mbuf_pull 掉已发的再接着发
+ssize_t mbuf_sendmsg(int fd, mbuf_t *m, int flags) {
+    struct iovec iov[MBUF_IOV_MAX];
+    int n = mbuf_tx_iov(m, iov, MBUF_IOV_MAX);
+    if (n < 0) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = n };
+    return sendmsg(fd, &msg, flags);
+}
+
+// 收一个最多 size 字节的包到新链里，返回值同 recvmsg，> 0 时 *out 是收到的包
+// 数据报比 size 长时和 recv 一样截断，只留前 size 字节
+ssize_t mbuf_recvmsg(int fd, mbuf_t **out, int size, int flags) {
+    struct iovec iov[MBUF_IOV_MAX];
+    int niov;
+    *out = NULL;
+    mbuf_t *m = mbuf_rx_prepare(size, iov, MBUF_IOV_MAX, &niov);
+    if (!m) {
+        errno = ENOMEM;
+        return -1;
+    }
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = niov };
+    ssize_t r = recvmsg(fd, &msg, flags & ~MSG_TRUNC);
+    if (r <= 0) {
+        mbuf_free_chain(m);
+        return r;
+    }
+    mbuf_rx_commit(m, r);
+    *out = m;
+    return r;
+}
+
+// 一次 sendmmsg 发一批，返回发出去的包数，一个都没发出去返回 -1；包都不释放
+// 一批的 iovec 用完了就分几次 syscall，遇到发不完（非阻塞 socket 满了）就停
+int mbuf_sendmmsg(int fd, mbuf_t **pkts, int n, int flags) {
+    struct mmsghdr msgs[MBUF_MMSG_MAX];
+    struct iovec iov[MBUF_MMSG_IOV];
+    int done = 0;
+
+    while (done < n) {
+        int k = 0, used = 0;
+        while (done + k < n && k < MBUF_MMSG_MAX) {
+            int max = MBUF_MMSG_IOV - used < MBUF_IOV_MAX ? MBUF_MMSG_IOV - used : MBUF_IOV_MAX;
+            int c = mbuf_tx_iov(pkts[done + k], iov + used, max);
+            if (c < 0) break;
+            memset(&msgs[k], 0, sizeof(msgs[k]));
+            msgs[k].msg_hdr.msg_iov = iov + used;
+            msgs[k].msg_hdr.msg_iovlen = c;
+            used += c;
+            k++;
+        }
+        if (k == 0) {
+            // 一批刚开头就放不下，是这个包自己分片太多
+            errno = EMSGSIZE;
+            return done ? done : -1;
+        }
+        int r = sendmmsg(fd, msgs, k, flags);
+        if (r < 0) return done ? done : -1;
+        done += r;
+        if (r < k) break;
+    }
+    return done;
+}
+
+// 一次 recvmmsg 最多收 n 个（一轮不超过 MBUF_MMSG_MAX），每个最多 size 字节
+// 返回收到的包数，放在 pkts[0..ret)；没收到返回 -1 和 recvmmsg 的 errno
+int mbuf_recvmmsg(int fd, mbuf_t **pkts, int n, int size, int flags) {
+    struct mmsghdr msgs[MBUF_MMSG_MAX];
+    struct iovec iov[MBUF_MMSG_IOV];
+    int top = mbuf_rooms[MBUF_NUM_CLASSES - 1];
+    int k = n < MBUF_MMSG_MAX ? n : MBUF_MMSG_MAX;
+
+    if (size + MBUF_HEADROOM <= top) {
+        // 常见情况一个包一块 buffer，整批从 pool 里一次拿
+        if (mbuf_alloc_bulk(size, pkts, k) < 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+        for (int i = 0; i < k; i++) {
+            iov[i].iov_base = pkts[i]->tail;
+            iov[i].iov_len  = mbuf_tailroom(pkts[i]);
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    } else {
+        int used = 0;
+        for (int i = 0; i < k; i++) {
+            int c;
+            pkts[i] = mbuf_rx_prepare(size, iov + used, MBUF_MMSG_IOV - used, &c);
+            if (!pkts[i]) {
+                // iovec 或内存不够了，这一批就收这么多
+                k = i;
+                break;
+            }
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = iov + used;
+            msgs[i].msg_hdr.msg_iovlen = c;
+            used += c;
+        }
+        if (k == 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    // 和 mbuf_recvmsg 一样去掉 MSG_TRUNC：msg_len 报整包长度会越过准备好的 buffer
+    int r = recvmmsg(fd, msgs, k, flags & ~MSG_TRUNC, NULL);
+    if (r < 0) r = 0;
+    for (int i = 0; i < r; i++)
+        mbuf_rx_commit(pkts[i], msgs[i].msg_len);
+    mbuf_free_bulk(pkts + r, k - r);
+    return r ? r : -1;
+}
+
+/*
+ * MSG_ZEROCOPY：内核直接引用分片的页，send 返回后数据还没拷走
+ * 每次成功的 send 内核按 0, 1, 2 ... 编号，完成后在 error queue 上通知一段 [lo, hi]
+ * 在途期间持有一份 clone，各分片的 sh->refcnt 不会掉到 1：
+ *   原包可以照常 free，buffer 不会回 pool；谁要改都会先 CoW（mbuf_make_writable）
+ */
+typedef struct mbuf_zc {
+    int fd;
+    uint32_t next_id;               // 下一次 send 的编号
+    uint32_t done_id;               // 这之前的都完成了
+    uint32_t copied;                // 内核退化成拷贝的通知数（loopback 上总是）
+    mbuf_t *held[MBUF_ZC_SLOTS];    // 在途 send 的 clone，按编号取模放
+} mbuf_zc_t;
+
+static inline int mbuf_zc_inflight(mbuf_zc_t *zc) { return zc->next_id - zc->done_id; }
+
+// 打开 SO_ZEROCOPY；协议不支持（比如 AF_UNIX）返回 -1
+int mbuf_zc_init(mbuf_zc_t *zc, int fd) {
+    int one = 1;
+    memset(zc, 0, sizeof(*zc));
+    zc->fd = fd;
+    return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+}
+
+// 零拷贝发一个包，返回值同 sendmsg；在途满了返回 -1 / ENOBUFS，先 mbuf_zc_reap
+// 包本身调用者照常处理，引用由这里的 clone 撑着
+ssize_t mbuf_zc_send(mbuf_zc_t *zc, mbuf_t *m, int flags) {
+    if (mbuf_zc_inflight(zc) >= MBUF_ZC_SLOTS) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    mbuf_t *hold = mbuf_clone(m);
+    if (!hold) {
+        errno = ENOMEM;
+        return -1;
+    }
+    ssize_t r = mbuf_sendmsg(zc->fd, m, flags | MSG_ZEROCOPY);
+    if (r < 0) {
+        mbuf_free_chain(hold);
+        return r;
+    }
+    zc->held[zc->next_id++ % MBUF_ZC_SLOTS] = hold;
+    return r;
+}
+
+// 收 error queue 上的完成通知，放掉对应的 clone；不阻塞，返回这次完成的 send 数
+// 要等就 poll 这个 fd 的 POLLERR；关 socket 前 reap 到 mbuf_zc_inflight == 0
+int mbuf_zc_reap(mbuf_zc_t *zc) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) * 4];
+    int completed = 0;
+
+    for (;;) {
+        struct msghdr msg = { .msg_control = control, .msg_controllen = sizeof(control) };
+        if (recvmsg(zc->fd, &msg, MSG_ERRQUEUE) < 0)
+            break;      // EAGAIN：暂时没有了
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+            struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee->ee_errno != 0)
+                continue;
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zc->copied++;
+            // 编号会回绕，[lo, hi] 按无符号差算
+            for (uint32_t id = ee->ee_info; id - ee->ee_info <= ee->ee_data - ee->ee_info; id++) {
+                mbuf_t **slot = &zc->held[id % MBUF_ZC_SLOTS];
+                if (*slot) {
+                    mbuf_free_chain(*slot);
+                    *slot = NULL;
+                    completed++;
+                }
+            }
+        }
+    }
+    // 通知可能乱序到，done_id 只推过连续完成的那一段
+    while (zc->done_id != zc->next_id && !zc->held[zc->done_id % MBUF_ZC_SLOTS])
+        zc->done_id++;
+    return completed;
+}
+
+/* ==========================================
+ * 补全：io_uring 收发引擎
+ * ========================================== */
+// 不依赖 liburing，直接 syscall + mmap 三个环；一个引擎管一个 socket，只在一个线程里用
+// RX：provided buffer ring 里挂的是从 pool 拿的 mbuf 数据区，multishot recv 一直挂着，
+//     内核挑一块收进去，CQE 带回 bid，那个 mbuf 直接交出去，空位成批补新的
+// TX：一个包一个 SENDMSG，iovec 从分片链来（数据报不能按分片拆成几个 SEND）；完成前包归引擎
+// 内核不支持或被禁（sysctl、seccomp）时退回 recvmmsg / sendmmsg，接口不变
+#define MBUF_URING_ENTRIES  256                 // SQ 深度，CQ 默认是它的两倍
+#define MBUF_URING_RX_BUFS  256                 // provided buffer 数，2 的幂
+#define MBUF_URING_TX_SLOTS 128                 // 在途 send 数
+#define MBUF_URING_BGID     0
+#define MBUF_URING_RX_TAG   (1ULL << 32)        // user_data：multishot recv；TX 用槽号
+#define MBUF_URING_CANCEL_TAG (2ULL << 32)
+
+#define MBUF_URING_F_SYSCALL  (1 << 0)          // 不用 io_uring，直接走 mmsg
+
+typedef struct mbuf_uring_tx {
+    mbuf_t *pkt;
+    struct msghdr msg;                  // SENDMSG 完成前内核还会读，所以放在槽里
+    struct iovec iov[MBUF_IOV_MAX];
+} mbuf_uring_tx_t;
+
+typedef struct mbuf_uring {
+    int fd;
+    int ring_fd;                        // -1：退回 syscall
+    int rx_size;
+    uint64_t tx_errors;                 // 发送失败的包数（包照样释放）
+
+    unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries, sq_local;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *ring_map, *sqe_map;
+    size_t ring_map_sz, sqe_map_sz;
+
+    struct io_uring_buf_ring *br;
+    uint16_t br_tail;
+    bool rx_armed, closing;
+    mbuf_t *rx_bufs[MBUF_URING_RX_BUFS];        // bid -> 挂在 ring 上的 mbuf
+    uint16_t rx_empty[MBUF_URING_RX_BUFS];      // 被用掉、还没补的 bid
+    int rx_nempty;
+    mbuf_t *rx_ready[MBUF_URING_RX_BUFS];       // 收好了还没领走的包
+    unsigned rx_head, rx_tail;
+
+    int tx_inflight;
+    int tx_nfree;
+    int tx_free[MBUF_URING_TX_SLOTS];
+    mbuf_uring_tx_t tx[MBUF_URING_TX_SLOTS];
+} mbuf_uring_t;
+
+static inline bool mbuf_uring_active(mbuf_uring_t *u) { return u->ring_fd >= 0; }
+
+static int uring_enter(mbuf_uring_t *u, unsigned submit, unsigned wait) {
+    return syscall(__NR_io_uring_enter, u->ring_fd, submit, wait,
+                   wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+// SQ 满了返回 NULL
+static struct io_uring_sqe *uring_sqe(mbuf_uring_t *u) {
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sq_local - head == u->sq_entries)
+        return NULL;
+    unsigned idx = u->sq_local++ & u->sq_mask;
+    u->sq_array[idx] = idx;
+    memset(&u->sqes[idx], 0, sizeof(u->sqes[idx]));
+    return &u->sqes[idx];
+}
+
+// 把填好的 SQE 交给内核，顺便等 wait 个完成
+static int uring_submit(mbuf_uring_t *u, unsigned wait) {
+    __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+    unsigned pending = u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (!pending && !wait)
+        return 0;
+    int r;
+    while ((r = uring_enter(u, pending, wait)) < 0 && errno == EINTR)
+        ;
+    return r;
+}
+
+static void uring_arm_rx(mbuf_uring_t *u) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    if (!sqe) return;           // 下一轮 reap 再挂
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = u->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = MBUF_URING_BGID;
+    sqe->user_data = MBUF_URING_RX_TAG;
+    u->rx_armed = true;
+}
+
+// 用掉的 bid 成批补上新 mbuf，一次发布 ring tail；pool 空了就先空着，下次再补
+static void uring_refill(mbuf_uring_t *u) {
+    mbuf_t *fresh[MBUF_URING_RX_BUFS];
+    int k = u->rx_nempty;
+    if (!k || mbuf_alloc_bulk(u->rx_size, fresh, k) < 0)
+        return;
+    for (int i = 0; i < k; i++) {
+        uint16_t bid = u->rx_empty[i];
+        struct io_uring_buf *b = &u->br->bufs[u->br_tail++ & (MBUF_URING_RX_BUFS - 1)];
+        u->rx_bufs[bid] = fresh[i];
+        b->addr = (uintptr_t)fresh[i]->tail;
+        b->len  = mbuf_tailroom(fresh[i]);
+        b->bid  = bid;
+    }
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+    u->rx_nempty = 0;
+}
+
+// 收割 CQ：TX 完成就放包，RX 完成放进 rx_ready；rx_ready 满了就停，剩下的 CQE 留给下次
+static void uring_reap(mbuf_uring_t *u) {
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+        if (cqe->user_data == MBUF_URING_CANCEL_TAG)
+            continue;
+        if (cqe->user_data != MBUF_URING_RX_TAG) {
+            int slot = (int)cqe->user_data;
+            if (cqe->res < 0)
+                u->tx_errors++;
+            mbuf_free_chain(u->tx[slot].pkt);
+            u->tx[slot].pkt = NULL;
+            u->tx_free[u->tx_nfree++] = slot;
+            u->tx_inflight--;
+            continue;
+        }
+
+        if (u->rx_tail - u->rx_head == MBUF_URING_RX_BUFS)
+            break;
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            u->rx_armed = false;        // ENOBUFS 之类，multishot 停了，补完 buffer 再挂
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            mbuf_t *m = u->rx_bufs[bid];
+            u->rx_bufs[bid] = NULL;
+            u->rx_empty[u->rx_nempty++] = bid;
+            if (cqe->res > 0) {
+                m->tail += cqe->res;
+                m->pkt_len = cqe->res;
+                u->rx_ready[u->rx_tail++ & (MBUF_URING_RX_BUFS - 1)] = m;
+            } else {
+                mbuf_free_chain(m);
+            }
+        }
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    uring_refill(u);
+    if (!u->rx_armed && !u->closing) {
+        uring_arm_rx(u);
+        uring_submit(u, 0);
+    }
+}
+
+static void uring_teardown(mbuf_uring_t *u) {
+    if (u->br) {
+        struct io_uring_buf_reg reg = { .bgid = MBUF_URING_BGID };
+        syscall(__NR_io_uring_register, u->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(u->br, MBUF_URING_RX_BUFS * sizeof(struct io_uring_buf));
+    }
+    if (u->sqe_map) munmap(u->sqe_map, u->sqe_map_sz);
+    if (u->ring_map) munmap(u->ring_map, u->ring_map_sz);
+    close(u->ring_fd);
+    u->ring_fd = -1;
+}
+
+// 建 ring、注册 buffer ring、挂上 multishot recv；任何一步不行都返回 -1
+static int uring_setup(mbuf_uring_t *u) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->ring_fd = syscall(__NR_io_uring_setup, MBUF_URING_ENTRIES, &p);
+    if (u->ring_fd < 0)
+        return -1;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+        goto fail;
+
+    // SQ 和 CQ 的环共用一次 mmap
+    size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_map_sz = sq_sz > cq_sz ? sq_sz : cq_sz;
+    u->ring_map = mmap(NULL, u->ring_map_sz, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+    if (u->ring_map == MAP_FAILED) {
+        u->ring_map = NULL;
+        goto fail;
+    }
+    u->sqe_map_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqe_map = mmap(NULL, u->sqe_map_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+    if (u->sqe_map == MAP_FAILED) {
+        u->sqe_map = NULL;
+        goto fail;
+    }
+    char *r = u->ring_map;
+    u->sq_head    = (unsigned *)(r + p.sq_off.head);
+    u->sq_tail    = (unsigned *)(r + p.sq_off.tail);
+    u->sq_array   = (unsigned *)(r + p.sq_off.array);
+    u->sq_mask    = *(unsigned *)(r + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->sq_local   = *u->sq_tail;
+    u->cq_head    = (unsigned *)(r + p.cq_off.head);
+    u->cq_tail    = (unsigned *)(r + p.cq_off.tail);
+    u->cq_mask    = *(unsigned *)(r + p.cq_off.ring_mask);
+    u->cqes       = (struct io_uring_cqe *)(r + p.cq_off.cqes);
+    u->sqes       = u->sqe_map;
+
+    // buffer ring 自己 mmap（要页对齐），注册后内核从里面挑 buffer
+    size_t br_sz = MBUF_URING_RX_BUFS * sizeof(struct io_uring_buf);
+    void *br = mmap(NULL, br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED)
+        goto fail;
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uintptr_t)br,
+        .ring_entries = MBUF_URING_RX_BUFS,
+        .bgid = MBUF_URING_BGID,
+    };
+    if (syscall(__NR_io_uring_register, u->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(br, br_sz);
+        goto fail;
+    }
+    u->br = br;
+
+    for (int i = 0; i < MBUF_URING_RX_BUFS; i++)
+        u->rx_empty[i] = i;
+    u->rx_nempty = MBUF_URING_RX_BUFS;
+    uring_refill(u);
+    if (u->rx_nempty)
+        goto fail;
+    uring_arm_rx(u);
+    if (uring_submit(u, 0) < 0)
+        goto fail;
+    return 0;
+
+fail:
+    for (int i = 0; i < MBUF_URING_RX_BUFS; i++) {
+        mbuf_free_chain(u->rx_bufs[i]);
+        u->rx_bufs[i] = NULL;
+    }
+    uring_teardown(u);
+    return -1;
+}
+
+// rx_size：每个收包 buffer 的数据长度，超过最大一级返回 NULL
+// io_uring 用不了时照样返回引擎，mbuf_uring_active 为假，收发走 mmsg
+mbuf_uring_t *mbuf_uring_open(int fd, int rx_size, int flags) {
+    if (rx_size <= 0 || rx_size + MBUF_HEADROOM > mbuf_rooms[MBUF_NUM_CLASSES - 1])
+        return NULL;
+    mbuf_uring_t *u = calloc(1, sizeof(*u));
+    if (!u) return NULL;
+    u->fd = fd;
+    u->ring_fd = -1;
+    u->rx_size = rx_size;
+    for (int i = 0; i < MBUF_URING_TX_SLOTS; i++)
+        u->tx_free[i] = MBUF_URING_TX_SLOTS - 1 - i;
+    u->tx_nfree = MBUF_URING_TX_SLOTS;
+    if (!(flags & MBUF_URING_F_SYSCALL))
+        uring_setup(u);
+    return u;
+}
+
+// 取最多 n 个收好的包，不阻塞；没有返回 0
+int mbuf_uring_rx_burst(mbuf_uring_t *u, mbuf_t **pkts, int n) {
+    if (!mbuf_uring_active(u)) {
+        int r = mbuf_recvmmsg(u->fd, pkts, n, u->rx_size, MSG_DONTWAIT);
+        return r < 0 ? 0 : r;
+    }
+    uring_reap(u);
+    int k = 0;
+    while (k < n && u->rx_head != u->rx_tail)
+        pkts[k++] = u->rx_ready[u->rx_head++ & (MBUF_URING_RX_BUFS - 1)];
+    return k;
+}
+
+// 发一批，返回接下的包数；接下的包归引擎，发完（或失败）后由它释放
+// 在途槽或 SQ 满了就少接几个，剩下的调用者留着下次再发
+int mbuf_uring_tx_burst(mbuf_uring_t *u, mbuf_t **pkts, int n) {
+    if (!mbuf_uring_active(u)) {
+        int r = mbuf_sendmmsg(u->fd, pkts, n, MSG_DONTWAIT);
+        if (r <= 0) return 0;
+        mbuf_free_bulk(pkts, r);
+        return r;
+    }
+    if (u->tx_nfree < n)
+        uring_reap(u);
+
+    int k = 0;
+    for (; k < n && u->tx_nfree; k++) {
+        mbuf_uring_tx_t *t = &u->tx[u->tx_free[u->tx_nfree - 1]];
+        int niov = mbuf_tx_iov(pkts[k], t->iov, MBUF_IOV_MAX);
+        if (niov < 0) {
+            // 分片太多的包发不了，按失败算
+            u->tx_errors++;
+            mbuf_free_chain(pkts[k]);
+            continue;
+        }
+        struct io_uring_sqe *sqe = uring_sqe(u);
+        if (!sqe) break;
+        u->tx_nfree--;
+        t->pkt = pkts[k];
+        memset(&t->msg, 0, sizeof(t->msg));
+        t->msg.msg_iov = t->iov;
+        t->msg.msg_iovlen = niov;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = u->fd;
+        sqe->addr = (uintptr_t)&t->msg;
+        sqe->len = 1;
+        sqe->user_data = t - u->tx;
+        u->tx_inflight++;
+    }
+    uring_submit(u, 0);
+    return k;
+}
+
+// 阻塞到至少有一个完成（或 socket 可读）
+void mbuf_uring_wait(mbuf_uring_t *u) {
+    if (!mbuf_uring_active(u)) {
+        struct pollfd pfd = { .fd = u->fd, .events = POLLIN };
+        poll(&pfd, 1, -1);
+        return;
+    }
+    if (*u->cq_head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        uring_submit(u, 1);
+}
+
+// 撤掉 multishot recv、等在途的 send 都完成，再把 buffer 还回 pool
+void mbuf_uring_close(mbuf_uring_t *u) {
+    if (mbuf_uring_active(u)) {
+        u->closing = true;
+        struct io_uring_sqe *sqe;
+        while (!(sqe = uring_sqe(u)))
+            uring_submit(u, 1);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = MBUF_URING_RX_TAG;
+        sqe->user_data = MBUF_URING_CANCEL_TAG;
+        uring_submit(u, 0);
+        while (u->rx_armed || u->tx_inflight) {
+            uring_submit(u, 1);
+            uring_reap(u);
+            while (u->rx_head != u->rx_tail)
+                mbuf_free_chain(u->rx_ready[u->rx_head++ & (MBUF_URING_RX_BUFS - 1)]);
+        }
+        for (int i = 0; i < MBUF_URING_RX_BUFS; i++)
+            mbuf_free_chain(u->rx_bufs[i]);
+        uring_teardown(u);
+    }
+    free(u);
+}
+
+/* ==========================================
+ * 5. 场景演示
+ * ========================================== */
+
+static double now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// ring 压测：P 个生产者、C 个消费者，一批 32 个；lock 非 NULL 时换成现在用的加锁链表做对照
+enum { RB_ITEMS = 1 << 18, RB_BURST = 32, RB_LAT_ROUNDS = 20000 };
+
+typedef struct rb_ctx {
+    mbuf_ring_t *r;
+    pthread_mutex_t *lock;
+    mbuf_t *qhead, *qtail;          // 加锁链表，用 mbuf_t.next 串
+    mbuf_t *nodes;                  // 生产者 p 依次送 nodes[p], nodes[p + P], ...
+    int producers;
+    atomic_int consumed;
+    atomic_int errors;
+} rb_ctx_t;
+
+typedef struct rb_arg {
+    rb_ctx_t *ctx;
+    int id;
+} rb_arg_t;
+
+// 没活干时先转几圈，再让出 CPU
+static void rb_idle(unsigned *spins) {
+    if (++*spins < 64)
+        cpu_relax();
+    else
+        sched_yield();
+}
+
+static void *rb_producer(void *p) {
+    rb_arg_t *a = p;
+    rb_ctx_t *ctx = a->ctx;
+    mbuf_t *batch[RB_BURST];
+    unsigned spins = 0;
+    for (int i = a->id; i < RB_ITEMS; ) {
+        int k = 0;
+        for (; k < RB_BURST && i < RB_ITEMS; k++, i += ctx->producers)
+            batch[k] = &ctx->nodes[i];
+        if (ctx->lock) {
+            for (int j = 0; j < k; j++)
+                batch[j]->next = j + 1 < k ? batch[j + 1] : NULL;
+            pthread_mutex_lock(ctx->lock);
+            if (ctx->qtail) ctx->qtail->next = batch[0];
+            else ctx->qhead = batch[0];
+            ctx->qtail = batch[k - 1];
+            pthread_mutex_unlock(ctx->lock);
+            continue;
+        }
+        for (int done = 0; done < k; ) {
+            unsigned n = mbuf_ring_enqueue_burst(ctx->r, batch + done, k - done);
+            if (!n) rb_idle(&spins);
+            done += n;
+        }
+    }
+    return NULL;
+}
+
+// 每个生产者送来的包在同一个消费者看来必须是递增的
+static void *rb_consumer(void *p) {
+    rb_arg_t *a = p;
+    rb_ctx_t *ctx = a->ctx;
+    mbuf_t *batch[RB_BURST];
+    long last[8];
+    unsigned spins = 0;
+    for (int i = 0; i < 8; i++) last[i] = -1;
+
+    while (atomic_load_explicit(&ctx->consumed, memory_order_relaxed) < RB_ITEMS) {
+        unsigned n = 0;
+        if (ctx->lock) {
+            pthread_mutex_lock(ctx->lock);
+            while (n < RB_BURST && ctx->qhead) {
+                batch[n++] = ctx->qhead;
+                ctx->qhead = ctx->qhead->next;
+            }
+            if (!ctx->qhead) ctx->qtail = NULL;
+            pthread_mutex_unlock(ctx->lock);
+        } else {
+            n = mbuf_ring_dequeue_burst(ctx->r, batch, RB_BURST);
+        }
+        if (!n) {
+            rb_idle(&spins);
+            continue;
+        }
+        for (unsigned j = 0; j < n; j++) {
+            long idx = batch[j] - ctx->nodes;
+            int prod = idx % ctx->producers;
+            if (idx <= last[prod]) atomic_fetch_add(&ctx->errors, 1);
+            last[prod] = idx;
+        }
+        atomic_fetch_add_explicit(&ctx->consumed, n, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+// 返回 Mpkt/s，顺序错了 *errors 非 0
+static double rb_throughput(int flags, bool locked, int producers, int consumers,
+                            mbuf_t *nodes, int *errors) {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    rb_ctx_t ctx = { .nodes = nodes, .producers = producers };
+    ctx.r = locked ? NULL : mbuf_ring_create(1024, flags);
+    ctx.lock = locked ? &lock : NULL;
+    pthread_t th[8];
+    rb_arg_t args[8];
+
+    double t0 = now_ns();
+    for (int i = 0; i < producers + consumers; i++) {
+        args[i] = (rb_arg_t){ &ctx, i < producers ? i : i - producers };
+        pthread_create(&th[i], NULL, i < producers ? rb_producer : rb_consumer, &args[i]);
+    }
+    for (int i = 0; i < producers + consumers; i++)
+        pthread_join(th[i], NULL);
+    double t1 = now_ns();
+
+    *errors = atomic_load(&ctx.errors) + (atomic_load(&ctx.consumed) != RB_ITEMS);
+    mbuf_ring_free(ctx.r);
+    return RB_ITEMS * 1e3 / (t1 - t0);
+}
+
+// 乒乓：一个放进 r1，对面取出来放进 r2，再取回来；单程 = 往返 / 2
+typedef struct rb_pingpong {
+    mbuf_ring_t *r1, *r2;
+} rb_pingpong_t;
+
+static void *rb_pong(void *p) {
+    rb_pingpong_t *pp = p;
+    unsigned spins = 0;
+    for (int i = 0; i < RB_LAT_ROUNDS; i++) {
+        mbuf_t *m;
+        while (!(m = mbuf_ring_dequeue(pp->r1)))
+            rb_idle(&spins);
+        mbuf_ring_enqueue(pp->r2, m);
+    }
+    return NULL;
+}
+
+static int rb_cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void rb_latency(int flags, double *p50, double *p99) {
+    static double samples[RB_LAT_ROUNDS];
+    static mbuf_t token;
+    rb_pingpong_t pp = { mbuf_ring_create(64, flags), mbuf_ring_create(64, flags) };
+    pthread_t th;
+    unsigned spins = 0;
+    pthread_create(&th, NULL, rb_pong, &pp);
+    for (int i = 0; i < RB_LAT_ROUNDS; i++) {
+        double t0 = now_ns();
+        mbuf_ring_enqueue(pp.r1, &token);
+        while (!mbuf_ring_dequeue(pp.r2))
+            rb_idle(&spins);
+        samples[i] = (now_ns() - t0) / 2;
+    }
+    pthread_join(th, NULL);
+    qsort(samples, RB_LAT_ROUNDS, sizeof(samples[0]), rb_cmp_double);
+    *p50 = samples[RB_LAT_ROUNDS / 2];
+    *p99 = samples[RB_LAT_ROUNDS * 99 / 100];
+    mbuf_ring_free(pp.r1);
+    mbuf_ring_free(pp.r2);
+}
+
+static void rb_count_wm(mbuf_ring_t *r, enum mbuf_ring_event ev, void *arg) {
+    (void)r;
+    ((int *)arg)[ev]++;
+}
+
+// 现在隧道路径的做法：先拷成连续的，再逐字节算，拿来对照
+static uint16_t csum_bytewise(const unsigned char *p, int len) {
+    uint32_t sum = 0;
+    for (int i = 0; i + 1 < len; i += 2)
+        sum += p[i] << 8 | p[i + 1];
+    if (len & 1)
+        sum += p[len - 1] << 8;
+    return htons(~csum_fold(sum));
+}
+
+static uint32_t crc32c_bytewise(const unsigned char *p, int len) {
+    uint32_t crc = ~0u;
+    for (int i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+    }
+    return ~crc;
+}
+
+// 文件映射切成一片片挂出去，每片一个引用；最后一片放掉时才 munmap
+typedef struct ext_file {
+    unsigned char *map;
+    size_t size;
+    atomic_int slices;
+    int callbacks;
+} ext_file_t;
+
+static void ext_file_release(void *addr, void *opaque) {
+    ext_file_t *ef = opaque;
+    (void)addr;
+    ef->callbacks++;
+    if (atomic_fetch_sub(&ef->slices, 1) == 1)
+        munmap(ef->map, ef->size);
+}
+
+// 外部 buffer，只读映射的文件按 64KB 一片直接挂成分片；hdr 给 54 字节协议头
+static void test_extbuf(const unsigned char *hdr) {
+    enum { FILE_SIZE = 4 << 20, SLICE = 64 << 10, NSLICE = FILE_SIZE / SLICE, HDR_LEN = 54 };
+    char path[] = "/tmp/mbuf_extbuf_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("[Test ExtBuf] cannot create temp file, skipped\n");
+        return;
+    }
+    unlink(path);
+    unsigned char *fdata = malloc(FILE_SIZE);
+    for (int i = 0; i < FILE_SIZE; i++) fdata[i] = (unsigned char)(i * 31 + (i >> 12));
+    ext_file_t ef = { .size = FILE_SIZE, .map = MAP_FAILED };
+    if (write(fd, fdata, FILE_SIZE) == FILE_SIZE)
+        ef.map = mmap(NULL, FILE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ef.map == MAP_FAILED) {
+        printf("[Test ExtBuf] cannot map temp file, skipped\n");
+        free(fdata);
+        return;
+    }
+    atomic_init(&ef.slices, NSLICE);
+
+    // 每片一个包：协议头在 pool 里，文件内容挂外部 buffer
+    mbuf_t *files[NSLICE];
+    double t0 = now_ns();
+    for (int i = 0; i < NSLICE; i++) {
+        files[i] = mbuf_alloc(HDR_LEN);
+        mbuf_append_large(files[i], hdr, HDR_LEN);
+        mbuf_append_frag(files[i], mbuf_alloc_extbuf(ef.map + i * SLICE, SLICE, ext_file_release, &ef));
+    }
+    double t1 = now_ns();
+    // 对照：把文件内容拷进 pool
+    for (int i = 0; i < NSLICE; i++) {
+        mbuf_t *c = mbuf_alloc(HDR_LEN);
+        mbuf_append_large(c, hdr, HDR_LEN);
+        mbuf_append_large(c, fdata + i * SLICE, SLICE);
+        mbuf_free_chain(c);
+    }
+    double t2 = now_ns();
+
+    int bad = 0;
+    for (int i = 0; i < NSLICE; i++)
+        bad += files[i]->pkt_len != HDR_LEN + SLICE ||
+               mbuf_crc32c(files[i], HDR_LEN, SLICE) != crc32c_bytewise(fdata + i * SLICE, SLICE);
+
+    // clone 出去再放原包不回调；clone 改文件内容中间 16 字节只 CoW 那一段，映射是只读的也没事
+    mbuf_t *cl = mbuf_clone(files[0]);
+    mbuf_free_bulk(files, NSLICE / 2);
+    int before = ef.callbacks;
+    unsigned char patch[16];
+    memset(patch, 0x5a, sizeof(patch));
+    mbuf_cursor_t cur;
+    mbuf_cursor_init(&cur, cl);
+    mbuf_cursor_seek(&cur, HDR_LEN + 1000);
+    bad += mbuf_cursor_write(&cur, patch, sizeof(patch)) < 0;
+    mbuf_copy_bits(cl, HDR_LEN + 1000, patch, sizeof(patch));
+    bad += patch[0] != 0x5a || ef.map[1000] != fdata[1000];
+    mbuf_free_chain(cl);
+    mbuf_free_bulk(files + NSLICE / 2, NSLICE - NSLICE / 2);
+    printf("[Test ExtBuf] %d x %d KB file slices: attach %.0f ns/pkt, copy %.0f ns/pkt, "
+           "callbacks %d before last clone freed, %d after, %s\n",
+           NSLICE, SLICE >> 10, (t1 - t0) / NSLICE, (t2 - t1) / NSLICE, before, ef.callbacks,
+           !bad && before == NSLICE / 2 - 1 && ef.callbacks == NSLICE &&
+           atomic_load(&ef.slices) == 0 ? "ok" : "BROKEN");
+    free(fdata);
+}
+
+// 演示用的以太网 + IPv4 + TCP 头：总长度在 16，流的四元组在 26..37，序号在 38
+enum { GSO_HDR = 54, GSO_IPLEN = 16, GSO_FLOW = 26, GSO_FLOW_LEN = 12, GSO_SEQ = 38 };
+
+static uint32_t gso_get32(mbuf_t *m, int off) {
+    uint32_t v;
+    mbuf_copy_bits(m, off, &v, 4);
+    return ntohl(v);
+}
+
+// 同一条流、序号接得上才并；并之前把 merged 的 IP 总长度改成合并后的（头在 head 里，是自己的）
+static bool gso_tcp_match(mbuf_t *a, mbuf_t *b, void *arg) {
+    unsigned char ka[GSO_FLOW_LEN], kb[GSO_FLOW_LEN];
+    (void)arg;
+    mbuf_copy_bits(a, GSO_FLOW, ka, GSO_FLOW_LEN);
+    mbuf_copy_bits(b, GSO_FLOW, kb, GSO_FLOW_LEN);
+    if (memcmp(ka, kb, GSO_FLOW_LEN) ||
+        gso_get32(b, GSO_SEQ) != gso_get32(a, GSO_SEQ) + (a->pkt_len - GSO_HDR))
+        return false;
+    uint16_t iplen = htons(a->pkt_len + b->pkt_len - GSO_HDR - 14);
+    memcpy(a->data + GSO_IPLEN, &iplen, 2);
+    return true;
+}
+
+void dump_full(mbuf_t *m, const char *msg) {
+    printf("\n--- %s (Total: %d) ---\n", msg, m->pkt_len);
+    int idx = 0;
+    mbuf_t *curr = m;
+    while(curr) {
+        printf("Frag %d: [", idx++);
+        for (unsigned char *p = curr->data; p < curr->tail; p++) printf("%02X ", *p);
+        printf("]\n");
+        curr = curr->next_frag;
+    }
+}
+
+int main() {
+    // 1. 构造一个跨分片的包
+    // Frag 0: 4 bytes (Headroom 128)
+    mbuf_t *pkt = mbuf_alloc(4); 
+    uint8_t part1[] = {0xAA, 0xBB, 0xCC, 0xDD};
+    mbuf_append_large(pkt, part1, 4);
+
+    // Frag 1: 4 bytes (自动分配)
+    uint8_t part2[] = {0x11, 0x22, 0x33, 0x44};
+    mbuf_append_large(pkt, part2, 4);
+
+    dump_full(pkt, "Initial Packet");
+    // Memory: [AA BB CC DD] -> [11 22 33 44]
+
+    // -------------------------------------------------
+    // 测试 1: skb_copy_bits (全量导出)
+    // -------------------------------------------------
+    uint8_t full_copy[8];
+    mbuf_copy_bits(pkt, 0, full_copy, 8);
+    printf("\n[Test CopyBits] %02X %02X ... %02X\n", full_copy[0], full_copy[1], full_copy[7]);
+
+    // -------------------------------------------------
+    // 测试 2: skb_pull (剥离头部 2 字节)
+    // -------------------------------------------------
+    mbuf_pull(pkt, 2); 
+    dump_full(pkt, "After Pull(2)");
+    // Memory: [CC DD] -> [11 22 33 44] (Total 6)
+
+    // -------------------------------------------------
+    // 测试 3: skb_header_pointer (跨分片读取)
+    // -------------------------------------------------
+    // 现在 pkt 开头是 CC DD。
+    // 我们想读 offset=1 开始的 4 个字节 (即 DD 11 22 33)
+    // 这跨越了 Frag0 (只剩 DD) 和 Frag1 (11 22 33 ...)
+    uint8_t scratch[4];
+    void *ptr = mbuf_header_pointer(pkt, 1, 4, scratch);
+    
+    printf("\n[Test SmartPtr] Reading 4 bytes at offset 1:\n");
+    if (ptr == scratch) printf("-> Type: Slow Path (Copied)\n");
+    else printf("-> Type: Fast Path (Direct)\n");
+    
+    uint8_t *p = (uint8_t *)ptr;
+    printf("-> Data: %02X %02X %02X %02X (Expect: DD 11 22 33)\n", p[0], p[1], p[2], p[3]);
+
+    // -------------------------------------------------
+    // 测试 4: skb_trim (剪裁到总长 3)
+    // -------------------------------------------------
     // 当前总长 6: [CC DD] -> [11 22 33 44]
     // 剪裁到 3:  应该剩下 [CC DD] -> [11]
     // Frag 1 后面的 22 33 44 会被丢弃，如果 Frag 1 变空或多余会被释放
@@ -352,5 +2593,482 @@ int main() {
     dump_full(pkt, "After Trim(3)");
 
     mbuf_free_chain(pkt);
+
+    // -------------------------------------------------
+    // 测试 5: 单次分配的 pool mbuf (alloc / clone / free 不走 malloc)
+    // -------------------------------------------------
+    enum { ROUNDS = 1000000, BURST = 32 };
+    mbuf_t *burst[BURST];
+    double t0 = now_ns();
+    for (int r = 0; r < ROUNDS / BURST; r++) {
+        for (int i = 0; i < BURST; i++)
+            burst[i] = mbuf_alloc(1500);
+        for (int i = 0; i < BURST; i++)
+            mbuf_free_chain(burst[i]);
+    }
+    double t1 = now_ns();
+
+    mbuf_t *orig = mbuf_alloc(1500);
+    for (int i = 0; i < ROUNDS; i++)
+        mbuf_free_chain(mbuf_clone(orig));
+    double t2 = now_ns();
+
+    // 克隆后写原包触发 CoW，两边各自释放，buffer 都要回到 pool
+    mbuf_t *c = mbuf_clone(orig);
+    mbuf_append_large(orig, part1, 4);
+    printf("\n[Test Pool] alloc+free %.1f ns, clone+free %.1f ns, CoW split: %s\n",
+           (t1 - t0) / ROUNDS, (t2 - t1) / ROUNDS,
+           orig->sh != c->sh && mbuf_len(c) == 0 && mbuf_len(orig) == 4 ? "ok" : "BROKEN");
+    mbuf_free_chain(c);
+
+    // -------------------------------------------------
+    // 测试 6: 批量 API，一批 32 个
+    // -------------------------------------------------
+    t0 = now_ns();
+    for (int r = 0; r < ROUNDS / BURST; r++) {
+        mbuf_alloc_bulk(1500, burst, BURST);
+        mbuf_free_bulk(burst, BURST);
+    }
+    t1 = now_ns();
+    for (int r = 0; r < ROUNDS / BURST; r++) {
+        mbuf_clone_bulk(orig, burst, BURST);
+        mbuf_free_bulk(burst, BURST);
+    }
+    t2 = now_ns();
+    printf("[Test Bulk] alloc_bulk+free_bulk %.1f ns/pkt, clone_bulk+free_bulk %.1f ns/pkt, refcnt back to %d\n",
+           (t1 - t0) / ROUNDS, (t2 - t1) / ROUNDS, atomic_load(&orig->sh->refcnt));
+
+    mbuf_free_chain(orig);
+
+    // -------------------------------------------------
+    // 测试 7: 长链（64KB 由 128 字节分片拼成），追加 + 逐字段解析
+    // -------------------------------------------------
+    enum { MSG_LEN = 64 * 1024, FIELD = 4 };
+    mbuf_t *msg = mbuf_alloc(0);
+    uint32_t word;
+    t0 = now_ns();
+    for (uint32_t i = 0; i < MSG_LEN / FIELD; i++)
+        mbuf_append_large(msg, &i, FIELD);    // 尾分片直接取 last_frag
+    t1 = now_ns();
+
+    uint32_t bad = 0;
+    for (uint32_t i = 0; i < MSG_LEN / FIELD; i++) {   // 每个字段都从头找分片
+        uint32_t *w = mbuf_header_pointer(msg, i * FIELD, FIELD, &word);
+        bad += !w || *w != i;
+    }
+    t2 = now_ns();
+
+    mbuf_cursor_t cur;
+    mbuf_cursor_init(&cur, msg);
+    for (uint32_t i = 0; i < MSG_LEN / FIELD; i++) {
+        uint32_t *w = mbuf_cursor_ptr(&cur, FIELD, &word);
+        bad += !w || *w != i;
+    }
+    double t3 = now_ns();
+
+    int frags = 0;
+    for (mbuf_t *f = msg; f; f = f->next_frag)
+        frags++;
+    printf("[Test Cursor] %d frags: append %.1f us, header_pointer parse %.1f us, cursor parse %.1f us, %s\n",
+           frags, (t1 - t0) / 1e3, (t2 - t1) / 1e3, (t3 - t2) / 1e3, bad ? "MISMATCH" : "ok");
+
+    // -------------------------------------------------
+    // 测试 8: 跨分片 linearize / pull
+    // -------------------------------------------------
+    // 前 6000 字节收进 head 后原地读；再剥掉 5000 字节（跨好几个分片）
+    int lin = mbuf_linearize(msg, 6000);
+    uint32_t *w0 = (uint32_t *)msg->data;
+    bad = lin < 0 || mbuf_len(msg) < 6000 || w0[0] != 0 || w0[1499] != 1499;
+    uint32_t *w1 = mbuf_pull(msg, 5000);
+    bad += !w1 || *w1 != 1250 || msg->pkt_len != MSG_LEN - 5000;
+    mbuf_pull(msg, 3000);
+    uint32_t *w2 = mbuf_header_pointer(msg, 0, FIELD, &word);
+    bad += !w2 || *w2 != 2000;
+    printf("[Test Linearize] linearize(6000) head %d bytes, pull across frags -> %s\n",
+           lin < 0 ? -1 : 6000, bad ? "MISMATCH" : "ok");
+    mbuf_free_chain(msg);
+
+    // -------------------------------------------------
+    // 测试 9: 广播改头，按范围 CoW vs 整包 CoW
+    // -------------------------------------------------
+    // 9000 字节的 jumbo 克隆给 32 个订阅者，每人只改 14 字节以太网头
+    enum { JUMBO = 9000, ETH_HLEN = 14, FANOUT_ROUNDS = 2000 };
+    static unsigned char jumbo[JUMBO], eth[ETH_HLEN];
+    for (int i = 0; i < JUMBO; i++) jumbo[i] = (unsigned char)i;
+    memset(eth, 0xee, sizeof(eth));
+    orig = mbuf_alloc(JUMBO);
+    mbuf_append_large(orig, jumbo, JUMBO);
+
+    bad = 0;
+    t0 = now_ns();
+    for (int r = 0; r < FANOUT_ROUNDS; r++) {
+        mbuf_clone_bulk(orig, burst, BURST);
+        for (int i = 0; i < BURST; i++) {
+            mbuf_cursor_init(&cur, burst[i]);
+            bad += mbuf_cursor_write(&cur, eth, ETH_HLEN) < 0;
+        }
+        // 改过的头是自己的，后面 8986 字节还和原包共用一块 buffer
+        bad += burst[0]->sh == orig->sh || !burst[0]->next_frag ||
+               burst[0]->next_frag->sh != orig->sh || burst[0]->pkt_len != JUMBO;
+        mbuf_free_bulk(burst, BURST);
+    }
+    t1 = now_ns();
+    for (int r = 0; r < FANOUT_ROUNDS; r++) {
+        mbuf_clone_bulk(orig, burst, BURST);
+        for (int i = 0; i < BURST; i++) {
+            if (mbuf_ensure_writable(burst[i]) == 0)
+                memcpy(burst[i]->data, eth, ETH_HLEN);
+        }
+        mbuf_free_bulk(burst, BURST);
+    }
+    t2 = now_ns();
+    bad += memcmp(orig->data, jumbo, JUMBO) != 0 || atomic_load(&orig->sh->refcnt) != 1;
+    printf("[Test Range CoW] %d B x %d clones, rewrite %d B header: range %.1f ns/pkt, whole %.1f ns/pkt, %s\n",
+           JUMBO, BURST, ETH_HLEN, (t1 - t0) / (FANOUT_ROUNDS * BURST),
+           (t2 - t1) / (FANOUT_ROUNDS * BURST), bad ? "MISMATCH" : "ok");
+    mbuf_free_chain(orig);
+
+    // -------------------------------------------------
+    // 测试 10: 走 loopback UDP 收发分片链，单个 vs 批量 syscall，再试 MSG_ZEROCOPY
+    // -------------------------------------------------
+    enum { SG_LEN = 2 + 2 * JUMBO, IO_ROUNDS = 200 };
+    static unsigned char sg_out[SG_LEN];
+    int tx = socket(AF_INET, SOCK_DGRAM, 0), rx = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t salen = sizeof(sa);
+    int rcvbuf = 4 << 20;
+    setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (tx < 0 || rx < 0 || bind(rx, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+        getsockname(rx, (struct sockaddr *)&sa, &salen) < 0 ||
+        connect(tx, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        printf("[Test Socket] loopback UDP unavailable, skipped\n");
+        return 0;
+    }
+
+    // 2 + 18000 字节：head 只有 2 字节，后面是按 max_seg 切的一串分片，原样发出去
+    pkt = mbuf_alloc(2);
+    mbuf_append_large(pkt, "hi", 2);
+    mbuf_append_large(pkt, jumbo, JUMBO);
+    mbuf_append_large(pkt, jumbo, JUMBO);
+    int nfrag = 0;
+    for (mbuf_t *f = pkt; f; f = f->next_frag) nfrag++;
+    mbuf_t *got = NULL;
+    bad = mbuf_sendmsg(tx, pkt, 0) != SG_LEN || mbuf_recvmsg(rx, &got, 65536, 0) != SG_LEN;
+    bad += !got || mbuf_copy_bits(got, 0, sg_out, SG_LEN) < 0 || memcmp(sg_out, "hi", 2) ||
+           memcmp(sg_out + 2, jumbo, JUMBO) || memcmp(sg_out + 2 + JUMBO, jumbo, JUMBO);
+    mbuf_free_chain(got);
+    printf("[Test Socket] %d B in %d frags sent without linearize -> %s\n",
+           SG_LEN, nfrag, bad ? "MISMATCH" : "ok");
+    mbuf_free_chain(pkt);
+
+    // 32 个 1500 字节的包：一个包一次 syscall vs 一批一次
+    mbuf_alloc_bulk(1500, burst, BURST);
+    for (int i = 0; i < BURST; i++) {
+        mbuf_append_large(burst[i], jumbo, 1500);
+        burst[i]->data[0] = i;
+    }
+    mbuf_t *rxb[BURST];
+    int lost = 0;
+    t0 = now_ns();
+    for (int r = 0; r < IO_ROUNDS; r++) {
+        for (int i = 0; i < BURST; i++)
+            mbuf_sendmsg(tx, burst[i], 0);
+        for (int i = 0; i < BURST; i++) {
+            if (mbuf_recvmsg(rx, &got, 2048, MSG_DONTWAIT) != 1500) { lost++; continue; }
+            mbuf_free_chain(got);
+        }
+    }
+    t1 = now_ns();
+    for (int r = 0; r < IO_ROUNDS; r++) {
+        int sent = mbuf_sendmmsg(tx, burst, BURST, 0);
+        for (int k = 0; k < sent; ) {
+            int n = mbuf_recvmmsg(rx, rxb, sent - k, 2048, MSG_DONTWAIT);
+            if (n < 0) break;
+            for (int i = 0; i < n; i++)
+                bad += rxb[i]->pkt_len != 1500 || rxb[i]->data[0] != (unsigned char)(k + i);
+            mbuf_free_bulk(rxb, n);
+            k += n;
+        }
+    }
+    t2 = now_ns();
+    printf("[Test Socket] %d x 1500 B: sendmsg/recvmsg %.1f ns/pkt, sendmmsg/recvmmsg %.1f ns/pkt, lost %d, %s\n",
+           BURST, (t1 - t0) / (IO_ROUNDS * BURST), (t2 - t1) / (IO_ROUNDS * BURST),
+           lost, bad ? "MISMATCH" : "ok");
+
+    // 零拷贝：原包发完立刻 free，buffer 由在途的 clone 撑着，完成通知到了才回 pool
+    mbuf_zc_t zc;
+    if (mbuf_zc_init(&zc, tx) < 0) {
+        printf("[Test ZeroCopy] SO_ZEROCOPY unsupported, skipped\n");
+        mbuf_free_bulk(burst, BURST);
+    } else {
+        int held = 0;
+        for (int i = 0; i < BURST; i++)
+            if (mbuf_zc_send(&zc, burst[i], 0) == 1500) held++;
+        held = held == BURST && atomic_load(&burst[0]->sh->refcnt) == 2;
+        mbuf_free_bulk(burst, BURST);
+        for (int i = 0; i < 1000 && mbuf_zc_inflight(&zc); i++) {
+            mbuf_zc_reap(&zc);
+            if (mbuf_zc_inflight(&zc)) usleep(1000);
+        }
+        int got;
+        while ((got = mbuf_recvmmsg(rx, rxb, BURST, 2048, MSG_DONTWAIT)) > 0)
+            mbuf_free_bulk(rxb, got);
+        printf("[Test ZeroCopy] %d sends held until completion: %s, inflight %d, copied %u\n",
+               BURST, held ? "ok" : "BROKEN", mbuf_zc_inflight(&zc), zc.copied);
+    }
+
+    // -------------------------------------------------
+    // 测试 11: io_uring 引擎 vs 一批一次 syscall，同样 32 个一批收发
+    // -------------------------------------------------
+    for (int mode = 0; mode < 2; mode++) {
+        int flags = mode ? MBUF_URING_F_SYSCALL : 0;
+        mbuf_uring_t *ut = mbuf_uring_open(tx, 2048, flags);
+        mbuf_uring_t *ur = mbuf_uring_open(rx, 2048, flags);
+        if (!mode && !mbuf_uring_active(ur))
+            printf("[Test io_uring] io_uring unavailable, falling back to mmsg\n");
+        int got = 0, sent = 0;
+        bad = 0;
+        t0 = now_ns();
+        for (int r = 0; r < IO_ROUNDS; r++) {
+            mbuf_alloc_bulk(1500, burst, BURST);
+            for (int i = 0; i < BURST; i++) {
+                mbuf_append_large(burst[i], jumbo, 1500);
+                burst[i]->data[0] = i;
+            }
+            int k = 0;
+            while (k < BURST)
+                k += mbuf_uring_tx_burst(ut, burst + k, BURST - k);
+            sent += k;
+            for (int n = 0; n < BURST; ) {
+                int c = mbuf_uring_rx_burst(ur, rxb, BURST - n);
+                if (!c) {
+                    mbuf_uring_wait(ur);
+                    continue;
+                }
+                for (int i = 0; i < c; i++)
+                    bad += rxb[i]->pkt_len != 1500 || rxb[i]->data[0] != (unsigned char)(n + i);
+                mbuf_free_bulk(rxb, c);
+                n += c;
+                got += c;
+            }
+        }
+        t1 = now_ns();
+        printf("[Test io_uring] %s: %d pkts in bursts of %d, %.1f ns/pkt, tx errors %llu, %s\n",
+               mbuf_uring_active(ur) ? "io_uring" : "mmsg", got, BURST,
+               (t1 - t0) / (IO_ROUNDS * BURST), (unsigned long long)ut->tx_errors,
+               bad || got != sent ? "MISMATCH" : "ok");
+        mbuf_uring_close(ut);
+        mbuf_uring_close(ur);
+    }
+    close(tx);
+    close(rx);
+
+    // -------------------------------------------------
+    // 测试 12: 无锁 ring 各模式的吞吐、单程延迟，对照加锁链表；水位回调
+    // -------------------------------------------------
+    static const struct { const char *name; int flags, producers, consumers; } rb_modes[] = {
+        { "SPSC 1P1C", MBUF_RING_SPSC, 1, 1 },
+        { "MPSC 2P1C", MBUF_RING_MPSC, 2, 1 },
+        { "MPMC 2P2C", MBUF_RING_MPMC, 2, 2 },
+    };
+    mbuf_t *nodes = calloc(RB_ITEMS, sizeof(mbuf_t));
+    for (size_t i = 0; i < ARRAY_SIZE(rb_modes); i++) {
+        int e1, e2;
+        double p50, p99;
+        double ring = rb_throughput(rb_modes[i].flags, false, rb_modes[i].producers,
+                                    rb_modes[i].consumers, nodes, &e1);
+        double list = rb_throughput(0, true, rb_modes[i].producers,
+                                    rb_modes[i].consumers, nodes, &e2);
+        rb_latency(rb_modes[i].flags, &p50, &p99);
+        printf("[Test Ring] %s: ring %.1f Mpkt/s, mutex list %.1f Mpkt/s, one-way p50 %.0f ns p99 %.0f ns, %s\n",
+               rb_modes[i].name, ring, list, p50, p99, e1 || e2 ? "MISMATCH" : "ok");
+    }
+    free(nodes);
+
+    int wm[2] = { 0, 0 };
+    mbuf_ring_t *ring = mbuf_ring_create(64, MBUF_RING_SPSC);
+    mbuf_ring_set_watermark(ring, 48, 16, rb_count_wm, wm);
+    mbuf_alloc_bulk(64, burst, BURST);
+    for (int r = 0; r < 2; r++) {
+        mbuf_ring_enqueue_bulk(ring, burst, BURST);
+        mbuf_ring_enqueue_bulk(ring, burst, BURST);
+        bad = mbuf_ring_enqueue(ring, burst[0]) != -1 || mbuf_ring_count(ring) != 64;
+        while (mbuf_ring_dequeue_burst(ring, rxb, 20))
+            ;
+    }
+    printf("[Test Ring] watermark 48/16 over 2 fill/drain cycles: high %d low %d, %s\n",
+           wm[MBUF_RING_WM_HIGH], wm[MBUF_RING_WM_LOW],
+           !bad && wm[0] == 2 && wm[1] == 2 && mbuf_ring_count(ring) == 0 ? "ok" : "BROKEN");
+    mbuf_free_bulk(burst, BURST);
+    mbuf_ring_free(ring);
+
+    // -------------------------------------------------
+    // 测试 13: 分片链上直接算校验和 / CRC32C，对照 linearize + 逐字节；增量更新
+    // -------------------------------------------------
+    // 9001 字节按奇数长度切成一串分片，很多段从奇数偏移开始
+    enum { CS_LEN = 9001, CS_ROUNDS = 2000 };
+    static unsigned char flat[CS_LEN];
+    pkt = mbuf_alloc(7);
+    for (int off = 0, n = 7; off < CS_LEN; off += n, n = (n * 7 + 13) % 601 + 1) {
+        if (off + n > CS_LEN) n = CS_LEN - off;
+        mbuf_t *f = off ? mbuf_alloc_frag(n) : pkt;
+        memcpy(f->tail, jumbo + off % 7, n);
+        f->tail += n;
+        pkt->pkt_len += n;
+        if (f != pkt) {
+            mbuf_last(pkt)->next_frag = f;
+            pkt->last_frag = f;
+        }
+    }
+    nfrag = 0;
+    for (mbuf_t *f = pkt; f; f = f->next_frag) nfrag++;
+    mbuf_copy_bits(pkt, 0, flat, CS_LEN);
+
+    bad = mbuf_crc32c(pkt, 0, 0) != 0 || crc32c_bytewise((const unsigned char *)"123456789", 9) != 0xE3069283;
+    for (int i = 0; i < 200; i++) {
+        int off = i * 37 % CS_LEN, len = (i * 7919) % (CS_LEN - off + 1);
+        bad += mbuf_csum(pkt, off, len) != csum_bytewise(flat + off, len);
+        bad += mbuf_crc32c(pkt, off, len) != crc32c_bytewise(flat + off, len);
+    }
+
+    static volatile uint32_t sink;
+    t0 = now_ns();
+    // 每轮改一个字节，免得编译器把没变的计算提到循环外
+    for (int r = 0; r < CS_ROUNDS; r++) {
+        pkt->data[0] = r;
+        mbuf_copy_bits(pkt, 0, flat, CS_LEN);
+        sink += csum_bytewise(flat, CS_LEN);
+    }
+    t1 = now_ns();
+    for (int r = 0; r < CS_ROUNDS; r++) {
+        pkt->data[0] = r;
+        sink += mbuf_csum(pkt, 0, CS_LEN);
+    }
+    t2 = now_ns();
+    t3 = now_ns();
+    for (int r = 0; r < CS_ROUNDS; r++) {
+        pkt->data[0] = r;
+        mbuf_copy_bits(pkt, 0, flat, CS_LEN);
+        sink += crc32c_bytewise(flat, CS_LEN);
+    }
+    double t4 = now_ns();
+    for (int r = 0; r < CS_ROUNDS; r++) {
+        pkt->data[0] = r;
+        sink += mbuf_crc32c(pkt, 0, CS_LEN);
+    }
+    double t5 = now_ns();
+    printf("[Test Csum] %d B in %d frags: csum linearize+bytewise %.0f ns, chain %s %.0f ns; "
+           "crc32c linearize+bytewise %.0f ns, chain %s %.0f ns, %s\n",
+           CS_LEN, nfrag, (t1 - t0) / CS_ROUNDS, g_csum_impl, (t2 - t1) / CS_ROUNDS,
+           (t4 - t3) / CS_ROUNDS, g_crc_impl, (t5 - t4) / CS_ROUNDS,
+           bad ? "MISMATCH" : "ok");
+
+    // 隧道解封：带着整包和剥掉 14 字节外层头（再剥 1 字节试奇数），
+    // 然后改内层 IPv4 头的 TTL 和目的地址，校验和增量更新，和重算的比
+    uint32_t rcsum = mbuf_csum_partial(pkt, 0, pkt->pkt_len, 0);
+    mbuf_pull_rcsum(pkt, 14, &rcsum);
+    bad = csum_fold(rcsum) != csum_fold(mbuf_csum_partial(pkt, 0, pkt->pkt_len, 0));
+    mbuf_pull_rcsum(pkt, 1, &rcsum);
+    bad += csum_fold(rcsum) != csum_fold(mbuf_csum_partial(pkt, 0, pkt->pkt_len, 0));
+
+    mbuf_linearize(pkt, 20);
+    unsigned char *ip = pkt->data;
+    uint16_t *ip_csum = (uint16_t *)(ip + 10);
+    *ip_csum = 0;
+    *ip_csum = mbuf_csum(pkt, 0, 20);
+    uint16_t ttl_proto, ttl_proto_new;
+    uint32_t daddr, daddr_new = htonl(0x0a000001);
+    memcpy(&ttl_proto, ip + 8, 2);
+    memcpy(&daddr, ip + 16, 4);
+    ip[8]--;
+    memcpy(&ttl_proto_new, ip + 8, 2);
+    memcpy(ip + 16, &daddr_new, 4);
+    csum_replace2(ip_csum, ttl_proto, ttl_proto_new);
+    csum_replace4(ip_csum, daddr, daddr_new);
+    bad += mbuf_csum(pkt, 0, 20) != 0;
+    printf("[Test Csum] pull_rcsum across 14 + 1 bytes, incremental TTL/daddr rewrite -> %s\n",
+           bad ? "MISMATCH" : "ok");
+    mbuf_free_chain(pkt);
+
+    // -------------------------------------------------
+    // 测试 14: 外部 buffer，只读映射的文件按 64KB 一片直接挂成分片
+    // -------------------------------------------------
+    test_extbuf(jumbo);
+
+    // -------------------------------------------------
+    // 测试 15: 64KB 大包按 MSS 1448 切段再合并回来（GSO / GRO），负载不拷
+    // -------------------------------------------------
+    enum { SUPER = 64000, MSS = 1448, NSEG = (SUPER + MSS - 1) / MSS, GSO_ROUNDS = 200 };
+    static unsigned char big[SUPER];
+    unsigned char hdr[GSO_HDR] = { 0 };
+    for (int i = 0; i < SUPER; i++) big[i] = (unsigned char)(i * 7 + (i >> 9));
+    for (int i = GSO_FLOW; i < GSO_FLOW + GSO_FLOW_LEN; i++) hdr[i] = i;
+
+    mbuf_t *supers[2];
+    for (int k = 0; k < 2; k++) {
+        hdr[GSO_FLOW + GSO_FLOW_LEN - 1] = k;          // 两条流，目的端口不同
+        uint32_t seq = htonl(1000 + k);
+        memcpy(hdr + GSO_SEQ, &seq, 4);
+        supers[k] = mbuf_alloc(GSO_HDR);
+        mbuf_append_large(supers[k], hdr, GSO_HDR);
+        mbuf_append_large(supers[k], big, SUPER);
+    }
+
+    t0 = now_ns();
+    for (int r = 0; r < GSO_ROUNDS; r++) {
+        mbuf_t *segs = mbuf_segment(supers[0], MSS, GSO_HDR);
+        while (segs) {
+            mbuf_t *next = segs->next;
+            mbuf_free_chain(segs);
+            segs = next;
+        }
+    }
+    t1 = now_ns();
+    // 对照：每段 alloc 一个包把头和负载都拷进去
+    for (int r = 0; r < GSO_ROUNDS; r++) {
+        for (int i = 0; i < NSEG; i++) {
+            int n = SUPER - i * MSS < MSS ? SUPER - i * MSS : MSS;
+            mbuf_t *c = mbuf_alloc(GSO_HDR + n);
+            mbuf_copy_bits(supers[0], 0, c->tail, GSO_HDR);
+            mbuf_copy_bits(supers[0], GSO_HDR + i * MSS, c->tail + GSO_HDR, n);
+            c->tail += GSO_HDR + n;
+            c->pkt_len = GSO_HDR + n;
+            mbuf_free_chain(c);
+        }
+    }
+    t2 = now_ns();
+
+    // 两个大包都切开，按段改序号和 IP 总长度，原包先放掉（负载靠段里的 clone 撑着）
+    mbuf_t *segs[2 * NSEG];
+    int nsegs = 0;
+    bad = 0;
+    for (int k = 0; k < 2; k++) {
+        int i = 0;
+        for (mbuf_t *sg = mbuf_segment(supers[k], MSS, GSO_HDR), *next; sg; sg = next, i++) {
+            next = sg->next;
+            sg->next = NULL;
+            uint32_t seq = htonl(1000 + k + i * MSS);
+            uint16_t iplen = htons(sg->pkt_len - 14);
+            memcpy(sg->data + GSO_SEQ, &seq, 4);
+            memcpy(sg->data + GSO_IPLEN, &iplen, 2);
+            bad += sg->pkt_len != GSO_HDR + (i < NSEG - 1 ? MSS : SUPER - i * MSS) ||
+                   mbuf_crc32c(sg, GSO_HDR, sg->pkt_len - GSO_HDR) !=
+                   crc32c_bytewise(big + i * MSS, sg->pkt_len - GSO_HDR);
+            segs[nsegs++] = sg;
+        }
+        bad += i != NSEG;
+        mbuf_free_chain(supers[k]);
+    }
+
+    int left = mbuf_coalesce(segs, nsegs, GSO_HDR, 65535, gso_tcp_match, NULL);
+    for (int k = 0; k < left; k++)
+        bad += segs[k]->pkt_len != GSO_HDR + SUPER || gso_get32(segs[k], GSO_SEQ) != 1000u + k ||
+               mbuf_crc32c(segs[k], GSO_HDR, SUPER) != crc32c_bytewise(big, SUPER) ||
+               ntohs(*(uint16_t *)(segs[k]->data + GSO_IPLEN)) != GSO_HDR + SUPER - 14;
+    printf("[Test GSO] %d B -> %d x %d B segments: segment %.1f us, copy %.1f us; "
+           "coalesce %d segments of 2 flows -> %d packets, %s\n",
+           SUPER, NSEG, MSS, (t1 - t0) / GSO_ROUNDS / 1e3, (t2 - t1) / GSO_ROUNDS / 1e3,
+           nsegs, left, bad || left != 2 ? "MISMATCH" : "ok");
+    mbuf_free_bulk(segs, left);
     return 0;
 }
\ No newline at end of file
@@ -5,19 +5,73 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <time.h>
+#include <sched.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <assert.h>
+#if defined(__x86_64__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define MP_HAVE_RSEQ 1
+#else
+#define MP_HAVE_RSEQ 0
+#endif
 //gcc -O2 -DNDEBUG t6.c -o a.out
 /* ==========================================
  * 配置与宏定义
  * ========================================== */
+/* mp_pool_attr_t 对应字段为 0 时的默认值 */
 #define OBJECT_SIZE           2048
 #define LOCAL_CACHE_CAPACITY  512
 #define BATCH_SIZE            32
 #define CACHE_LINE            64
 
+/* 每个线程按 pool id 查自己的 cache */
+#define MP_MAX_POOLS          256
+
+/* size class：64 ~ 2048，按 2 的幂分级 */
+#define MP_MIN_SHIFT          6
+#define MP_NUM_CLASSES        6
+#define MP_MAX_SIZED          (1UL << (MP_MIN_SHIFT + MP_NUM_CLASSES - 1))
+
+/* chunk 按自身大小对齐，头部记录归属 pool，mp_free 靠指针反查 */
+#define MP_CHUNK_SIZE         (2UL << 20)
+
+/* mp_pool_attr_t.flags：chunk 的大页策略 */
+#define MP_POOL_HUGETLB       (1 << 0)  // 先试 MAP_HUGETLB，没有预留大页就退回 THP
+#define MP_POOL_THP           (1 << 1)  // madvise(MADV_HUGEPAGE)
+#define MP_POOL_POPULATE      (1 << 2)  // 映射时就串行预缺页（MAP_POPULATE / MADV_POPULATE_WRITE）
+#define MP_POOL_REMOTE_FREE   (1 << 3)  // 记录对象属主，跨线程 free 直接送回属主
+#define MP_POOL_PERCPU        (1 << 4)  // rseq 每 CPU 一个 cache，不支持时退回线程 cache
+#define MP_POOL_MADV_FREE     (1 << 5)  // 回收用 MADV_FREE（内存紧张时才真正释放），默认 MADV_DONTNEED
+#define MP_POOL_FIXED_CACHE   (1 << 6)  // 线程 cache 固定为 cache_capacity，不按频率伸缩
+
+/* 线程 cache 自适应：两次慢路径间隔短于 HOT 时 flush 就翻倍，长于 IDLE 就减半 */
+#define MP_ADAPT_HOT_NS       (100 * 1000LL)
+#define MP_ADAPT_IDLE_NS      (100 * 1000000LL)
+#define MP_CACHE_BUDGET_MUL   16        // 默认预算 = max(cache_capacity * 16, max_count / 2)
+
+/* 每个 pool 最多这么多线程拥有远程释放队列，超出的线程退化成普通 free */
+#define MP_MAX_OWNERS         1024
+
+/* 全局 depot 的同步方式 */
+#define MP_DEPOT_LOCKFREE     0   // Treiber 栈 + 版本号，单次 CAS
+#define MP_DEPOT_SPIN         1   // 自旋锁保护，对照组
+
+/* depot 栈顶：低 48 位指针 + 高 16 位版本号，防 ABA */
+#define TAG_SHIFT             48
+#define TAG_PTR(v)            ((magazine_t *)(uintptr_t)((v) & ((1ULL << TAG_SHIFT) - 1)))
+#define TAG_VER(v)            ((v) >> TAG_SHIFT)
+#define TAG_MAKE(p, ver)      (((uint64_t)(ver) << TAG_SHIFT) | (uint64_t)(uintptr_t)(p))
+
+/* magazine 壳按块分配，只在 pool 销毁时释放 */
+#define MAG_BLOCK             64
+
 //向上取整 让x成为a的倍数，a必须是2的幂
 #define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((a) - 1))
 //是否是2的幂
@@ -29,7 +83,9 @@
 //向下截取 x是a的倍数 a必须是2的幂
 #define ALIGN_DOWN(x, a)  ((x) & ~((a) - 1))
 
+#ifndef offsetof
 #define offsetof(type, member) ((size_t) &((type *)0)->member)
+#endif
 
 #define container_of(ptr, type, member) ({          \
     const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
@@ -39,294 +95,2961 @@
  * 数据结构
  * ========================================== */
 
-typedef struct free_node {
-    struct free_node *next;
-} free_node_t;
+// 一批空闲对象的指针数组（tcmalloc transfer cache 的做法）
+// 整批进出 depot 只动 magazine 本身，不碰对象内存
+typedef struct magazine {
+    _Atomic(struct magazine *) next;   // depot 栈 / 线程空壳链表
+    int count;
+    void *rounds[];                    // 容量 = pool->batch
+} magazine_t;
+
+typedef struct mag_block {
+    struct mag_block *next;
+    int used;
+    uint8_t mags[] __attribute__((aligned(sizeof(void *))));  // MAG_BLOCK 个，步长 pool->mag_size
+} mag_block_t;
+
+// 远程释放队列：Vyukov 侵入式 MPSC，节点就是 magazine
+// 送别的线程的对象先装进 magazine，生产者一次 xchg 挂整个壳（wait-free），
+// 属主整批 memcpy 收走，两边都不碰对象内存
+typedef struct {
+    _Atomic(magazine_t *) tail;       // 生产者端
+    atomic_int            state;      // 0 空闲 / 1 有属主 / 2 被别人临时收养
+    __attribute__((aligned(CACHE_LINE)))
+    magazine_t           *head;       // 消费者端，只有持有槽位的线程碰
+    struct {
+        _Atomic(magazine_t *) next;   // 和 magazine_t 开头一致，只当链接用
+    } stub;
+} __attribute__((aligned(CACHE_LINE))) remote_queue_t;
+
+#define RQ_STUB(q) ((magazine_t *)&(q)->stub)
+
+// 只有所属线程写，mp_pool_stats 从别的线程 relaxed 读，不用 RMW
+typedef struct {
+    long long alloc;
+    long long free;
+    long long refill;
+    long long flush;
+    long long remote;   // 送去别的线程的 free
+    long long wait;     // refill 时 pool 已空的次数（含 try/timed 失败）
+} mp_counters_t;
+
+#define STAT_INC(x) \
+    __atomic_store_n(&(x), __atomic_load_n(&(x), __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED)
+
+// tc->count 同理：只有本线程改，统计线程会读
+#define CACHE_SET_COUNT(tc, v) __atomic_store_n(&(tc)->count, (v), __ATOMIC_RELAXED)
 
 typedef struct {
-    pthread_spinlock_t lock;
-    free_node_t *free_head;
+    // 只读配置单独占一条 cache line，快路径查 id/gen 不和 depot 抢
+    int      id;          // 线程 cache 表的下标
+    uint64_t gen;         // 创建序号，id 复用时识别过期的 cache
+    size_t   obj_size;    // 对象大小（已按 cache line 对齐）
+    int      cache_cap;   // 线程 cache 容量
+    int      batch;       // magazine 容量 / 单次 refill 个数
+    size_t   mag_size;
+    int      class_idx;   // 所属 size class，-1 表示独立 pool
+    size_t   first_obj;   // chunk 内第一个对象的偏移（头部 + 属主表之后）
+    int      per_chunk;   // 每个 chunk 的对象数
+    remote_queue_t *remote;   // MP_POOL_REMOTE_FREE：按属主编号索引
+    atomic_int      owners_hw;    // 用过的最大属主编号，收养时只扫到这里
+    uint8_t        *percpu;       // MP_POOL_PERCPU：ncpu 个 cpu_cache_t，步长 cpu_stride
+    size_t          cpu_stride;
+    int             ncpu;
+
+    __attribute__((aligned(CACHE_LINE)))
+    pthread_spinlock_t lock;      // 仅 MP_DEPOT_SPIN 使用
+    _Atomic uint64_t   full;      // 满 magazine 栈顶（带版本号）
+    _Atomic uint64_t   empty;     // 空壳栈顶（带版本号）
+    int                depot_mode;
+    atomic_long        depot_objs;  // 满 magazine 里的对象数，只给统计用
+    long               cache_budget;  // 各线程 cache 的 limit 之和不超过它
+    atomic_long        cache_limits;  // 当前 limit 之和
+
+    pthread_mutex_t mag_lock;     // 新壳分配，慢路径
+    mag_block_t    *mag_blocks;
 
     pthread_mutex_t wait_lock;
-    pthread_cond_t  wait_cond;
-    int             waiters;
-
-    void   *mmap_base;
-    size_t  mmap_size;
+    pthread_cond_t  wait_cond;    // CLOCK_MONOTONIC
+    atomic_int      waiters;
+    atomic_int      efd;          // mp_pool_eventfd，-1 表示没人要
+    atomic_int      notify;       // 分配失败后登记，下次有对象回来写一次 efd
+
+    pthread_mutex_t    grow_lock;   // 保护登记表、bump 游标和扩容
+    struct chunk_hdr  *chunks;      // chunk 登记表，destroy 时按段 munmap
+    int                total;       // 已映射的对象数
+
+    // bump 区：映射了但从没发出去过的对象，用到才切
+    uint8_t           *carve_chunk; // 当前 chunk
+    uint8_t           *carve_ptr;   // 下一个对象
+    int                carve_left;  // 当前映射段还能切的对象数
+    int                grow_count;  // 每次扩容的对象数，0 表示不扩容
+    int                max_count;   // 硬上限
+    int                flags;
+
+    // 回收：整块空闲的 chunk madvise 掉后挂在 idle 上（grow_lock 保护），切的时候优先用
+    struct chunk_hdr  *idle;
+    int                idle_cnt;
+    pthread_mutex_t    scav_lock;    // 串行化 mp_pool_scavenge，也给后台线程睡觉用
+    pthread_cond_t     scav_cond;
+    atomic_uint        scav_seq;     // 回收开始、结束各加一；奇数时 depot 倒空着，depot_empty 不可信
+    pthread_t          scav_thread;
+    int                scav_ms;      // 后台回收周期，0 表示不起线程
+    int                retain;       // 后台回收时保持常驻的空闲对象数
+    bool               scav_stop;
+
+    // 统计：在场线程的 cache 挂在 caches 上，退出线程的计数并进 retired
+    pthread_mutex_t      stats_lock;
+    struct thread_cache *caches;
+    mp_counters_t        retired;
+    _Atomic long long    pc_refill;   // MP_POOL_PERCPU 的慢路径次数
+    _Atomic long long    pc_flush;
+    _Atomic long long    spin_ns;     // 抢 pool->lock 没抢到、自旋的时间
+    _Atomic long long    wait_ns;     // 睡在 wait_cond 上的时间
 } __attribute__((aligned(64))) global_pool_t;
 
+// MP_POOL_PERCPU：每个 CPU 一个对象栈，只在 rseq 临界区里改
+// 字段用 long，汇编里直接当 64 位下标；objects 固定在偏移 16
+typedef struct {
+    long count;
+    long capacity;
+    void *objects[];
+} cpu_cache_t;
+
+// 每个 chunk 开头的对象槽位留给头部
+typedef struct chunk_hdr {
+    global_pool_t *pool;
+    struct chunk_hdr *next;   // 同一 pool 的 chunk 链表
+    size_t map_size;          // 一次 mmap 的首个 chunk 记录整段长度，其余为 0
+    struct chunk_hdr *idle_next;  // 已还给内核、等着重新切
+    int scav_cnt;             // 回收时临时计数：depot 里有几个对象属于本 chunk，-1 表示本轮摘走
+    uint16_t owner[];         // MP_POOL_REMOTE_FREE：每个对象的属主编号，0 表示无
+} chunk_hdr_t;
+
+// mp_pool_create_ex 的参数，0 表示取默认值
 typedef struct {
-    void *objects[LOCAL_CACHE_CAPACITY];
+    size_t obj_size;       // 对象大小，默认 OBJECT_SIZE
+    int    cache_capacity; // 线程 cache 容量，默认 LOCAL_CACHE_CAPACITY
+    int    batch_size;     // 单次 refill / magazine 容量，默认 BATCH_SIZE
+    int    init_count;     // 创建时映射的对象数
+    int    grow_count;     // depot 耗尽时每次追加的对象数，0 表示不扩容
+    int    max_count;      // 对象总数硬上限，0 表示等于 init_count
+    int    flags;          // MP_POOL_* 组合
+    int    depot_mode;     // MP_DEPOT_LOCKFREE / MP_DEPOT_SPIN
+    int    scavenge_ms;    // >0 时起后台线程，每隔这么久回收一次空闲 chunk
+    int    retain_count;   // 后台回收时保持常驻的空闲对象数
+    int    cache_budget;   // 所有线程 cache 的容量合计上限，默认 max(cache_capacity * MP_CACHE_BUDGET_MUL, max_count / 2)
+} mp_pool_attr_t;
+
+// mp_pool_stats 的快照；各项分别读取，彼此之间不保证一致
+typedef struct {
+    size_t    obj_size;
+    int       total;        // 已映射的对象数
+    int       uncarved;     // 映射了但还没切过的，含回收后等着重新切的
+    int       high_water;   // 切出来且没被回收的对象数，即 在用 + 各级缓存 的峰值
+    long      depot_free;   // depot 满 magazine 里的对象
+    long      cached;       // 线程 / CPU cache 里的对象（近似）
+    long      in_use;       // high_water - depot_free - cached，含远程 free 在途的
+    long      cache_limit;  // 各线程 cache 当前容量之和
+    int       threads;      // 持有线程 cache 的在场线程数
+    long long alloc_cnt;    // 线程 cache 模式才计；每 CPU 模式的快路径不计数
+    long long free_cnt;
+    long long refill_cnt;
+    long long flush_cnt;
+    long long remote_cnt;
+    long long wait_cnt;
+    long long spin_ns;      // MP_DEPOT_SPIN 下在 pool->lock 上自旋的时间
+    long long wait_ns;      // 在 wait_cond 上阻塞的时间
+} mp_pool_stats_t;
+
+typedef struct thread_cache {
     int count;
+    int capacity;               // 从 pool 拷过来，快路径不碰 pool；objects[] 的大小
+    int limit;                  // 当前容量，在 [2 * batch, capacity] 里随 refill / flush 频率伸缩
+    int batch;
+    long long last_miss;        // 上次 refill / flush 的时间（CLOCK_MONOTONIC ns）
     global_pool_t *global;
+    int id;                     // 对应 pool->id / pool->gen
+    uint64_t gen;
+    struct thread_cache *next;  // 同一线程的所有 cache 串起来，退出时统一归还
 
-    long long alloc_cnt;
-    long long free_cnt;
-    long long wait_cnt;
+    magazine_t *spare;          // refill 换下来的空壳，flush 时直接装
+    int spare_cnt;
+
+    bool track_owner;           // pool 开了 MP_POOL_REMOTE_FREE
+    uint16_t owner;             // 本线程在 pool 里的属主编号，0 表示没有
+    remote_queue_t *rq;         // 别的线程 free 回来的对象
+
+    // 送往同一属主的对象先装进一个 magazine，装满或换属主时整个挂过去
+    magazine_t *rpend;
+    uint16_t rpend_owner;
+
+    mp_counters_t st;
+    struct thread_cache *sib_prev;  // 同一 pool 的全部线程 cache，给 mp_pool_stats 遍历
+    struct thread_cache *sib_next;
+
+    void *objects[];            // 容量 = capacity
 } thread_cache_t;
 
 /* ==========================================
  * TLS / pthread key
  * ========================================== */
 
-static __thread thread_cache_t *t_cache = NULL;
+static __thread thread_cache_t *t_caches[MP_MAX_POOLS];    // 按 pool id 索引
+static __thread thread_cache_t *t_cache_list = NULL;       // 本线程全部 cache
 static pthread_key_t cleanup_key;
 static pthread_once_t key_once = PTHREAD_ONCE_INIT;
 
+// pool id 登记表：gen 对不上的 cache 属于已销毁的 pool
+static pthread_mutex_t g_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static global_pool_t  *g_pools[MP_MAX_POOLS];
+static uint64_t        g_pool_gen;
+
+static global_pool_t *g_classes[MP_NUM_CLASSES];
+
 /* ==========================================
- * 线程清理
+ * 全局 depot：magazine 栈
  * ========================================== */
-static void thread_cleanup_handler(void *arg) {
-    // 1. 强转 arg，这是正统做法
-    thread_cache_t *tc = (thread_cache_t *)arg;
 
-    // 防御性检查：如果 Pthread 传空指针进来（虽然不应该），或者 count 为 0
-    if (!tc || tc->count == 0)
-        goto out;
+static inline long long mono_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
 
-    global_pool_t *pool = tc->global; // 这里的 tc 替代了 t_cache
+// 不争用时一次 trylock 就拿到，只有真的自旋才读时钟
+static inline void depot_lock(global_pool_t *pool) {
+    if (pthread_spin_trylock(&pool->lock) == 0)
+        return;
 
-    // 2. 下面的逻辑全部操作 tc
-    free_node_t *head = (free_node_t *)tc->objects[0];
-    free_node_t *cur  = head;
+    long long t0 = mono_ns();
+    pthread_spin_lock(&pool->lock);
+    atomic_fetch_add_explicit(&pool->spin_ns, mono_ns() - t0, memory_order_relaxed);
+}
 
-    for (int i = 1; i < tc->count; i++) {
-        cur->next = (free_node_t *)tc->objects[i];
-        cur = cur->next;
+// 把 [first .. last] 这一串 magazine 整体压栈
+static void depot_push(global_pool_t *pool, _Atomic uint64_t *top,
+                       magazine_t *first, magazine_t *last) {
+    if (pool->depot_mode == MP_DEPOT_SPIN) {
+        depot_lock(pool);
+        uint64_t old = atomic_load_explicit(top, memory_order_relaxed);
+        atomic_store_explicit(&last->next, TAG_PTR(old), memory_order_relaxed);
+        atomic_store_explicit(top, TAG_MAKE(first, TAG_VER(old)), memory_order_relaxed);
+        pthread_spin_unlock(&pool->lock);
+        return;
     }
-    cur->next = NULL;
 
-    pthread_spin_lock(&pool->lock);
-    bool need_signal = (pool->free_head == NULL);
-    cur->next = pool->free_head;
-    pool->free_head = head;
-    pthread_spin_unlock(&pool->lock);
+    uint64_t old = atomic_load_explicit(top, memory_order_relaxed);
+    uint64_t new;
+    do {
+        atomic_store_explicit(&last->next, TAG_PTR(old), memory_order_relaxed);
+        new = TAG_MAKE(first, TAG_VER(old));
+    } while (!atomic_compare_exchange_weak_explicit(top, &old, new,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
 
-    if (need_signal) {
-        pthread_mutex_lock(&pool->wait_lock);
-        if (pool->waiters > 0)
-            pthread_cond_broadcast(&pool->wait_cond);
-        pthread_mutex_unlock(&pool->wait_lock);
+// 弹出一个 magazine，空时返回 NULL
+static magazine_t *depot_pop(global_pool_t *pool, _Atomic uint64_t *top) {
+    if (pool->depot_mode == MP_DEPOT_SPIN) {
+        depot_lock(pool);
+        uint64_t old = atomic_load_explicit(top, memory_order_relaxed);
+        magazine_t *m = TAG_PTR(old);
+        if (m) {
+            magazine_t *next = atomic_load_explicit(&m->next, memory_order_relaxed);
+            atomic_store_explicit(top, TAG_MAKE(next, TAG_VER(old)), memory_order_relaxed);
+        }
+        pthread_spin_unlock(&pool->lock);
+        return m;
     }
 
-out:
-    // 3. 释放内存
-    if (tc) free(tc);
-    
-    // 4. 把全局 TLS 置空，防止悬垂指针（虽然线程马上要销毁了，但这是好习惯）
-    t_cache = NULL; 
+    uint64_t old = atomic_load_explicit(top, memory_order_acquire);
+    uint64_t new;
+    magazine_t *m;
+    do {
+        m = TAG_PTR(old);
+        if (!m) return NULL;
+        // m 可能已被别人弹走并复用，读到脏值没关系：版本号变了 CAS 必然失败
+        magazine_t *next = atomic_load_explicit(&m->next, memory_order_relaxed);
+        new = TAG_MAKE(next, TAG_VER(old) + 1);
+    } while (!atomic_compare_exchange_weak_explicit(top, &old, new,
+                                                    memory_order_acquire,
+                                                    memory_order_acquire));
+    return m;
 }
 
-static void make_cleanup_key(void) {
-    pthread_key_create(&cleanup_key, thread_cleanup_handler);
+static inline long long ts_to_ns(const struct timespec *t) {
+    return t->tv_sec * 1000000000LL + t->tv_nsec;
 }
 
-/* ==========================================
- * 核心逻辑：Flush / Refill
- * ========================================== */
+static inline struct timespec ns_to_ts(long long ns) {
+    return (struct timespec){ .tv_sec = ns / 1000000000LL, .tv_nsec = ns % 1000000000LL };
+}
 
-static void cache_flush(void) {
-    global_pool_t *pool = t_cache->global;
+static inline void depot_count(global_pool_t *pool, long n) {
+    atomic_fetch_add_explicit(&pool->depot_objs, n, memory_order_relaxed);
+}
 
-    int target = LOCAL_CACHE_CAPACITY / 2;
-    int n = t_cache->count - target;
-    if (n <= 0) return;
+static inline bool depot_empty(global_pool_t *pool) {
+    return TAG_PTR(atomic_load(&pool->full)) == NULL;
+}
+
+// 有人登记过 eventfd 通知就写一次，之后要重新登记
+static void notify_fire(global_pool_t *pool) {
+    if (atomic_exchange(&pool->notify, 0)) {
+        uint64_t one = 1;
+        if (write(atomic_load(&pool->efd), &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("eventfd write");
+    }
+}
+
+// 有人在 wait_cond 上等才去碰 wait_lock
+static void depot_signal(global_pool_t *pool) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pool->notify, memory_order_relaxed))
+        notify_fire(pool);
+    if (atomic_load_explicit(&pool->waiters, memory_order_relaxed) == 0)
+        return;
+
+    pthread_mutex_lock(&pool->wait_lock);
+    pthread_cond_broadcast(&pool->wait_cond);
+    pthread_mutex_unlock(&pool->wait_lock);
+}
 
-    int start = t_cache->count - n;
+// 新壳：壳一旦分配就不再释放，depot_pop 读到复用壳的 next 才是安全的
+static magazine_t *mag_alloc(global_pool_t *pool) {
+    pthread_mutex_lock(&pool->mag_lock);
+    mag_block_t *blk = pool->mag_blocks;
+    if (!blk || blk->used == MAG_BLOCK) {
+        blk = calloc(1, sizeof(mag_block_t) + MAG_BLOCK * pool->mag_size);
+        if (!blk) {
+            fprintf(stderr, "magazine alloc failed\n");
+            abort();
+        }
+        // 版本号占高 16 位，指针必须落在 48 位用户空间内
+        assert(((uintptr_t)blk >> TAG_SHIFT) == 0);
+        blk->next = pool->mag_blocks;
+        pool->mag_blocks = blk;
+    }
+    magazine_t *m = (magazine_t *)(blk->mags + pool->mag_size * blk->used++);
+    pthread_mutex_unlock(&pool->mag_lock);
+    return m;
+}
+
+// 取一个空壳：线程私有 > depot 空壳栈 > 新分配
+static magazine_t *mag_get_empty(thread_cache_t *tc) {
+    magazine_t *m = tc->spare;
+    if (m) {
+        tc->spare = atomic_load_explicit(&m->next, memory_order_relaxed);
+        tc->spare_cnt--;
+        return m;
+    }
 
-    free_node_t *head = (free_node_t *)t_cache->objects[start];
-    free_node_t *cur  = head;
+    m = depot_pop(tc->global, &tc->global->empty);
+    return m ? m : mag_alloc(tc->global);
+}
 
-    for (int i = 1; i < n; i++) {
-        cur->next = (free_node_t *)t_cache->objects[start + i];
-        cur = cur->next;
+static void mag_put_empty(thread_cache_t *tc, magazine_t *m) {
+    // 手里最多留够装满一次 flush 的空壳，多余的还给 depot
+    if (tc->spare_cnt > tc->limit / tc->batch) {
+        depot_push(tc->global, &tc->global->empty, m, m);
+        return;
     }
+    atomic_store_explicit(&m->next, tc->spare, memory_order_relaxed);
+    tc->spare = m;
+    tc->spare_cnt++;
+}
 
-    /* FIX-5: 明确断尾 */
-    cur->next = NULL;
+// 把 objs[0..n) 装进若干 magazine，串好后一次压栈
+static void global_push(thread_cache_t *tc, void **objs, int n) {
+    magazine_t *first = NULL, *last = NULL;
 
-    pthread_spin_lock(&pool->lock);
-    bool need_signal = (pool->free_head == NULL);
-    cur->next = pool->free_head;
-    pool->free_head = head;
-    pthread_spin_unlock(&pool->lock);
+    for (int i = 0; i < n; i += tc->batch) {
+        int cnt = (n - i < tc->batch) ? n - i : tc->batch;
+        magazine_t *m = mag_get_empty(tc);
 
-    t_cache->count = target;
+        memcpy(m->rounds, &objs[i], cnt * sizeof(void *));
+        m->count = cnt;
 
-    if (need_signal) {
-        pthread_mutex_lock(&pool->wait_lock);
-        if (pool->waiters > 0)
-            pthread_cond_broadcast(&pool->wait_cond);
-        pthread_mutex_unlock(&pool->wait_lock);
+        if (last)
+            atomic_store_explicit(&last->next, m, memory_order_relaxed);
+        else
+            first = m;
+        last = m;
     }
+
+    depot_push(tc->global, &tc->global->full, first, last);
+    depot_count(tc->global, n);
+    depot_signal(tc->global);
 }
 
-static void cache_refill(void) {
-    global_pool_t *pool = t_cache->global;
+/* ==========================================
+ * 远程释放队列
+ * ========================================== */
 
-    pthread_spin_lock(&pool->lock);
+static void remote_push(remote_queue_t *q, magazine_t *m) {
+    atomic_store_explicit(&m->next, NULL, memory_order_relaxed);
+    magazine_t *prev = atomic_exchange_explicit(&q->tail, m, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, m, memory_order_release);
+}
 
-    while (pool->free_head == NULL) {
-        pthread_spin_unlock(&pool->lock);
+static magazine_t *remote_pop(remote_queue_t *q) {
+    magazine_t *head = q->head;
+    magazine_t *next = atomic_load_explicit(&head->next, memory_order_acquire);
+
+    if (head == RQ_STUB(q)) {
+        if (!next) return NULL;
+        q->head = head = next;
+        next = atomic_load_explicit(&head->next, memory_order_acquire);
+    }
+    if (next) {
+        q->head = next;
+        return head;
+    }
+
+    // 只剩最后一个：生产者还没接上链就先别动，下次再取
+    if (head != atomic_load_explicit(&q->tail, memory_order_acquire))
+        return NULL;
+    remote_push(q, RQ_STUB(q));
+    next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (next) {
+        q->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+// 调用方必须持有这个槽位
+static inline bool remote_pending(remote_queue_t *q) {
+    return q->head != RQ_STUB(q) ||
+           atomic_load_explicit(&q->tail, memory_order_acquire) != RQ_STUB(q);
+}
 
-        t_cache->wait_cnt++;
+static void remote_queue_init(remote_queue_t *q) {
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->tail, RQ_STUB(q));
+    atomic_init(&q->state, 0);
+    q->head = RQ_STUB(q);
+}
 
-        pthread_mutex_lock(&pool->wait_lock);
-        pool->waiters++;
-        pthread_cond_wait(&pool->wait_cond, &pool->wait_lock);
-        pool->waiters--;
-        pthread_mutex_unlock(&pool->wait_lock);
+// 把队列里的 magazine 原样挂到 depot 满栈，返回挂了几个
+static int remote_to_depot(global_pool_t *pool, remote_queue_t *q) {
+    int n = 0;
+    magazine_t *m;
+    while ((m = remote_pop(q)) != NULL) {
+        depot_push(pool, &pool->full, m, m);
+        depot_count(pool, m->count);
+        n++;
+    }
+    return n;
+}
 
-        pthread_spin_lock(&pool->lock);
+// 线程已经退出的槽位里可能还有晚到的对象，没人认领前先收养进 depot
+// 不发 depot_signal：睡前复查时会在 wait_lock 里调用
+static bool remote_adopt(global_pool_t *pool) {
+    int hw = atomic_load_explicit(&pool->owners_hw, memory_order_acquire);
+    bool got = false;
+    for (int i = 0; i < hw; i++) {
+        remote_queue_t *q = &pool->remote[i];
+        int expect = 0;
+        if (atomic_load_explicit(&q->state, memory_order_relaxed) != 0 ||
+            !atomic_compare_exchange_strong(&q->state, &expect, 2))
+            continue;
+        if (remote_to_depot(pool, q) > 0)
+            got = true;
+        atomic_store_explicit(&q->state, 0, memory_order_release);
     }
+    return got;
+}
+
+// 把攒着的那个 magazine 送出去；属主可能正睡在 wait_cond 上
+static void remote_post(thread_cache_t *tc) {
+    if (!tc->rpend) return;
 
-    int fetched = 0;
-    while (fetched < BATCH_SIZE && pool->free_head) {
-        free_node_t *n = pool->free_head;
-        pool->free_head = n->next;
-        t_cache->objects[t_cache->count++] = n;
-        fetched++;
+    remote_push(&tc->global->remote[tc->rpend_owner - 1], tc->rpend);
+    tc->rpend = NULL;
+    depot_signal(tc->global);
+}
+
+static void remote_stash(thread_cache_t *tc, uint16_t owner, void *ptr) {
+    if (tc->rpend && tc->rpend_owner != owner)
+        remote_post(tc);
+
+    magazine_t *m = tc->rpend;
+    if (!m) {
+        m = tc->rpend = mag_get_empty(tc);
+        m->count = 0;
+        tc->rpend_owner = owner;
     }
+    m->rounds[m->count++] = ptr;
 
-    pthread_spin_unlock(&pool->lock);
+    if (m->count == tc->batch)
+        remote_post(tc);
 }
 
+// 收自己队列里的 magazine，留够一个 magazine 的空位才收
+static void remote_drain(thread_cache_t *tc) {
+    magazine_t *m;
+    while (tc->limit - tc->count >= tc->batch &&
+           (m = remote_pop(tc->rq)) != NULL) {
+        memcpy(&tc->objects[tc->count], m->rounds, m->count * sizeof(void *));
+        CACHE_SET_COUNT(tc, tc->count + m->count);
+        mag_put_empty(tc, m);
+    }
+}
 
+static inline uint16_t *obj_owner(global_pool_t *pool, void *ptr) {
+    chunk_hdr_t *c = (chunk_hdr_t *)ALIGN_DOWN((uintptr_t)ptr, MP_CHUNK_SIZE);
+    size_t idx = ((uint8_t *)ptr - (uint8_t *)c - pool->first_obj) / pool->obj_size;
+    return &c->owner[idx];
+}
 
-void mp_thread_init(global_pool_t *global) {
-    pthread_once(&key_once, make_cleanup_key);
+/* ==========================================
+ * 线程清理
+ * ========================================== */
+// cache 所属的 pool 是否还活着（id 可能已被新 pool 复用）
+static bool cache_live(thread_cache_t *tc) {
+    pthread_mutex_lock(&g_pools_lock);
+    bool live = g_pools[tc->id] && g_pools[tc->id]->gen == tc->gen;
+    pthread_mutex_unlock(&g_pools_lock);
+    return live;
+}
 
-    if (t_cache) return;
+static void counters_add(mp_counters_t *dst, mp_counters_t *src) {
+    dst->alloc  += __atomic_load_n(&src->alloc,  __ATOMIC_RELAXED);
+    dst->free   += __atomic_load_n(&src->free,   __ATOMIC_RELAXED);
+    dst->refill += __atomic_load_n(&src->refill, __ATOMIC_RELAXED);
+    dst->flush  += __atomic_load_n(&src->flush,  __ATOMIC_RELAXED);
+    dst->remote += __atomic_load_n(&src->remote, __ATOMIC_RELAXED);
+    dst->wait   += __atomic_load_n(&src->wait,   __ATOMIC_RELAXED);
+}
+
+// 从 pool 的 cache 表上摘下，计数并进 retired，线程走了数字还在
+static void cache_retire(thread_cache_t *tc) {
+    global_pool_t *pool = tc->global;
+
+    pthread_mutex_lock(&pool->stats_lock);
+    if (tc->sib_prev)
+        tc->sib_prev->sib_next = tc->sib_next;
+    else
+        pool->caches = tc->sib_next;
+    if (tc->sib_next)
+        tc->sib_next->sib_prev = tc->sib_prev;
+    counters_add(&pool->retired, &tc->st);
+    pthread_mutex_unlock(&pool->stats_lock);
+    atomic_fetch_sub_explicit(&pool->cache_limits, tc->limit, memory_order_relaxed);
+}
+
+static void thread_cleanup_handler(void *arg) {
+    // 1. 强转 arg，这是正统做法：链表头就是 t_cache_list
+    thread_cache_t *tc = (thread_cache_t *)arg;
+
+    // 2. 每个 cache 归还给各自的 pool，空壳也一并还回去；pool 已销毁的直接丢
+    while (tc) {
+        thread_cache_t *next = tc->next;
+        if (!cache_live(tc)) {
+            free(tc);
+            tc = next;
+            continue;
+        }
+
+        // 先把攒着要送人的送走，再收完自己队列里的，最后交还槽位
+        // 之后晚到的由下一个属主或收养者处理
+        remote_post(tc);
+        if (tc->rq) {
+            if (remote_to_depot(tc->global, tc->rq) > 0)
+                depot_signal(tc->global);
+            atomic_store_explicit(&tc->rq->state, 0, memory_order_release);
+        }
+
+        if (tc->count > 0)
+            global_push(tc, tc->objects, tc->count);
+
+        magazine_t *m;
+        while ((m = tc->spare) != NULL) {
+            tc->spare = atomic_load_explicit(&m->next, memory_order_relaxed);
+            depot_push(tc->global, &tc->global->empty, m, m);
+        }
+
+        cache_retire(tc);
+        free(tc);
+        tc = next;
+    }
+
+    // 3. 把全局 TLS 置空，防止悬垂指针（虽然线程马上要销毁了，但这是好习惯）
+    t_cache_list = NULL;
+    memset(t_caches, 0, sizeof(t_caches));
+}
+
+static void make_cleanup_key(void) {
+    pthread_key_create(&cleanup_key, thread_cleanup_handler);
+}
+
+// 慢路径：本线程还没有这个 pool 的 cache，或者槽位里是已销毁 pool 留下的旧 cache
+static thread_cache_t *cache_bind(global_pool_t *global) {
+    pthread_once(&key_once, make_cleanup_key);
 
-    t_cache = calloc(1, sizeof(thread_cache_t));
-    t_cache->global = global;
+    thread_cache_t *old = t_caches[global->id];
+    if (old) {
+        // 旧 pool 的内存已经没了，对象不能归还，只摘链释放
+        thread_cache_t **pp = &t_cache_list;
+        while (*pp != old)
+            pp = &(*pp)->next;
+        *pp = old->next;
+        free(old);
+    }
 
-    int ret = pthread_setspecific(cleanup_key, t_cache);
+    thread_cache_t *tc = calloc(1, sizeof(thread_cache_t) +
+                                   global->cache_cap * sizeof(void *));
+    if (!tc) {
+        fprintf(stderr, "thread cache alloc failed\n");
+        abort();
+    }
+    tc->global   = global;
+    tc->id       = global->id;
+    tc->gen      = global->gen;
+    tc->capacity = global->cache_cap;
+    tc->batch    = global->batch;
+    // 自适应的从最小起步，真热了再涨；冷线程一辈子只囤两个 batch
+    tc->limit    = (global->flags & MP_POOL_FIXED_CACHE) ? tc->capacity : 2 * tc->batch;
+    atomic_fetch_add_explicit(&global->cache_limits, tc->limit, memory_order_relaxed);
+
+    // 认领一个空闲的远程队列槽位，槽位编号 + 1 就是属主编号
+    tc->track_owner = global->remote != NULL;
+    for (int i = 0; global->remote && i < MP_MAX_OWNERS; i++) {
+        int expect = 0;
+        if (atomic_compare_exchange_strong(&global->remote[i].state, &expect, 1)) {
+            tc->owner = i + 1;
+            tc->rq    = &global->remote[i];
+            int hw = atomic_load(&global->owners_hw);
+            while (hw < tc->owner &&
+                   !atomic_compare_exchange_weak(&global->owners_hw, &hw, tc->owner))
+                ;
+            break;
+        }
+    }
+    tc->next = t_cache_list;
+    t_cache_list = tc;
+    t_caches[global->id] = tc;
+
+    pthread_mutex_lock(&global->stats_lock);
+    tc->sib_next = global->caches;
+    if (global->caches)
+        global->caches->sib_prev = tc;
+    global->caches = tc;
+    pthread_mutex_unlock(&global->stats_lock);
+
+    int ret = pthread_setspecific(cleanup_key, t_cache_list);
     if (ret != 0) {
         fprintf(stderr, "pthread_setspecific failed: %d\n", ret);
         abort();
     }
+    return tc;
 }
 
 /* ==========================================
- * Pool API
+ * 核心逻辑：Flush / Refill
  * ========================================== */
 
-global_pool_t *mp_pool_create(int count) {
-    pthread_once(&key_once, make_cleanup_key);
-
-    size_t sz = ALIGN_UP(sizeof(global_pool_t), CACHE_LINE); /* FIX-6 */
-    global_pool_t *pool = aligned_alloc(CACHE_LINE, sz);
+// 慢路径里按间隔调 limit：flush 得勤说明 cache 太小，隔很久才来说明囤多了
+// 只有 flush 才涨（grow）：refill 勤只说明分配多，一直只分配不释放的线程涨了也是白囤
+// 涨要从 pool 的预算里扣，扣不到就不涨；返回 limit 是否变大
+static bool cache_adapt(thread_cache_t *tc, bool grow) {
+    global_pool_t *pool = tc->global;
+    if (pool->flags & MP_POOL_FIXED_CACHE) return false;
+
+    long long now = mono_ns(), dt = now - tc->last_miss;
+    tc->last_miss = now;
+
+    if (grow && dt < MP_ADAPT_HOT_NS && tc->limit < tc->capacity) {
+        // 翻倍涨，几次 flush 就够到工作集；预算不够整步就退一半，直到不足一个 batch
+        int step = tc->capacity - tc->limit < tc->limit ? tc->capacity - tc->limit : tc->limit;
+        for (;;) {
+            if (atomic_fetch_add_explicit(&pool->cache_limits, step, memory_order_relaxed) + step
+                <= pool->cache_budget) {
+                tc->limit += step;
+                return true;
+            }
+            atomic_fetch_sub_explicit(&pool->cache_limits, step, memory_order_relaxed);
+            if (step <= tc->batch) break;
+            step /= 2;
+        }
+    } else if (dt > MP_ADAPT_IDLE_NS && tc->limit > 2 * tc->batch) {
+        int drop = tc->limit - (tc->limit / 2 > 2 * tc->batch ? tc->limit / 2 : 2 * tc->batch);
+        tc->limit -= drop;
+        atomic_fetch_sub_explicit(&pool->cache_limits, drop, memory_order_relaxed);
+    }
+    return false;
+}
 
-    pthread_spin_init(&pool->lock, PTHREAD_PROCESS_PRIVATE);
-    pthread_mutex_init(&pool->wait_lock, NULL);
-    pthread_cond_init(&pool->wait_cond, NULL);
-    pool->waiters = 0;
+// limit 刚缩过时 count 可能比 limit 还多，一样减到一半
+static void cache_flush(thread_cache_t *tc) {
+    int target = tc->limit / 2;
+    int n = tc->count - target;
+    if (n <= 0) return;
 
-    size_t obj_sz = ALIGN_UP(OBJECT_SIZE, CACHE_LINE);
-    size_t total  = obj_sz * count;
+    STAT_INC(tc->st.flush);
+    global_push(tc, &tc->objects[target], n);
+    CACHE_SET_COUNT(tc, target);
+}
 
-    void *base = mmap(NULL, total, PROT_READ | PROT_WRITE,
-                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (base == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
+static int  pool_carve(global_pool_t *pool, void **out, int n);
+static bool pool_grow(global_pool_t *pool);
+
+// 先登记 waiters 再复查，和 depot_signal 配对，不会丢唤醒
+// 远程 free 也会 signal，所以自己的队列和无主槽位要一起复查
+// 回收把 depot 倒空期间也在这里等，它放回来 / 结束时会 signal；scav_seq 是调用方
+// pool_grow 之前读的，之后回收开始或结束过就不睡，回去重试
+// deadline 是 CLOCK_MONOTONIC 绝对时间，NULL 表示一直等；过了 deadline 返回 false
+static bool depot_wait(global_pool_t *pool, remote_queue_t *rq, unsigned scav_seq,
+                       const struct timespec *deadline) {
+    bool adopted = false, ok = true;
+
+    if (deadline && mono_ns() >= ts_to_ns(deadline))
+        return false;
+
+    pthread_mutex_lock(&pool->wait_lock);
+    atomic_fetch_add(&pool->waiters, 1);
+    if (depot_empty(pool) && atomic_load(&pool->scav_seq) == scav_seq &&
+        !(rq && remote_pending(rq)) &&
+        !(pool->remote && (adopted = remote_adopt(pool)))) {
+        long long t0 = mono_ns();
+        const struct timespec *until = deadline;
+        struct timespec wake;
+        if (pool->percpu) {
+            // 每 CPU 栈的 free 只做不带屏障的 waiters 检查，可能错过一次，限时醒来兜底
+            wake = ns_to_ts(t0 + 1000000);
+            if (!deadline || ts_to_ns(&wake) < ts_to_ns(deadline))
+                until = &wake;
+        }
+
+        if (!until)
+            pthread_cond_wait(&pool->wait_cond, &pool->wait_lock);
+        else if (pthread_cond_timedwait(&pool->wait_cond, &pool->wait_lock, until) == ETIMEDOUT &&
+                 until == deadline)
+            ok = false;
+        atomic_fetch_add_explicit(&pool->wait_ns, mono_ns() - t0, memory_order_relaxed);
     }
+    atomic_fetch_sub(&pool->waiters, 1);
+    pthread_mutex_unlock(&pool->wait_lock);
+
+    // 收养进 depot 的也叫醒别的等待者
+    if (adopted)
+        depot_signal(pool);
+    return ok;
+}
 
-    pool->mmap_base = base;
-    pool->mmap_size = total;
-    pool->free_head = NULL;
+// 整批拷进本地数组，壳留给下一次 flush
+static void cache_take(thread_cache_t *tc, magazine_t *m) {
+    depot_count(tc->global, -m->count);
+    memcpy(&tc->objects[tc->count], m->rounds, m->count * sizeof(void *));
+    CACHE_SET_COUNT(tc, tc->count + m->count);
+    mag_put_empty(tc, m);
+}
 
-    uint8_t *p = base;
-    for (int i = 0; i < count; i++) {
-        free_node_t *n = (free_node_t *)p;
-        n->next = pool->free_head;
-        pool->free_head = n;
-        p += obj_sz;
+// 到 deadline 还没等到就空手返回，tc->count 仍为 0
+static void cache_refill(thread_cache_t *tc, const struct timespec *deadline) {
+    global_pool_t *pool = tc->global;
+    magazine_t *m;
+
+    STAT_INC(tc->st.refill);
+    cache_adapt(tc, false);
+    // 一次拿 limit 的四分之一，至少一个 magazine：limit 涨了批也跟着涨
+    int want = tc->limit / 4 > tc->batch ? tc->limit / 4 : tc->batch;
+
+    // 别的线程 free 回来的先用，整批收进来；顺便把自己攒着的送出去
+    if (tc->track_owner)
+        remote_post(tc);
+    if (tc->rq) {
+        remote_drain(tc);
+        if (tc->count > 0)
+            return;
     }
 
-    return pool;
+    while ((m = depot_pop(pool, &pool->full)) == NULL) {
+        // 先从 bump 区切新对象，切完了再扩容，都不行才睡
+        int n = pool_carve(pool, &tc->objects[tc->count], want - tc->count);
+        if (n > 0) {
+            CACHE_SET_COUNT(tc, tc->count + n);
+            return;
+        }
+        unsigned seq = atomic_load(&pool->scav_seq);
+        if (pool_grow(pool))
+            continue;
+        if (tc->rq) {
+            remote_drain(tc);
+            if (tc->count > 0)
+                return;
+        }
+
+        STAT_INC(tc->st.wait);
+        if (!depot_wait(pool, tc->rq, seq, deadline))
+            return;
+    }
+
+    cache_take(tc, m);
+    // 多要的只拿 depot 里现成的，不切不等
+    while (tc->count + tc->batch <= want && (m = depot_pop(pool, &pool->full)) != NULL)
+        cache_take(tc, m);
 }
 
-void mp_pool_destroy(global_pool_t *pool) {
-    if (!pool) return;
 
-    munmap(pool->mmap_base, pool->mmap_size);
-    pthread_spin_destroy(&pool->lock);
-    pthread_mutex_destroy(&pool->wait_lock);
-    pthread_cond_destroy(&pool->wait_cond);
-    free(pool);
+/* ==========================================
+ * Per-CPU cache（rseq）
+ * ========================================== */
+#if MP_HAVE_RSEQ
+// glibc 2.35+ 已经给每个线程注册好 rseq，区域在线程指针 + __rseq_offset
+static inline struct rseq *rseq_area(void) {
+    return (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+}
+
+static bool rseq_usable(void) {
+    return __rseq_size > 0 && (int)rseq_area()->cpu_id >= 0;
+}
+
+// 临界区 [1, 2) 里读 cpu_id、算出本 CPU 的栈，最后一条 store 提交
+// 被抢占、迁移或来信号时内核把 ip 改到 4，从 0 重新登记再来
+#define RSEQ_CS_BEGIN                                   \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                \
+    ".balign 32\n\t"                                    \
+    "3:\n\t"                                            \
+    ".long 0, 0\n\t"                                    \
+    ".quad 1f, (2f - 1f), 4f\n\t"                       \
+    ".popsection\n\t"                                   \
+    "0:\n\t"                                            \
+    "leaq 3b(%%rip), %[tmp]\n\t"                        \
+    "movq %[tmp], %c[cs_off](%[rs])\n\t"                \
+    "1:\n\t"
+
+#define RSEQ_CS_END                                     \
+    "2:\n\t"                                            \
+    ".pushsection __rseq_failure, \"ax\"\n\t"           \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                        \
+    ".long " MP_STR(RSEQ_SIG) "\n\t"                    \
+    "4:\n\t"                                            \
+    "jmp 0b\n\t"                                        \
+    ".popsection\n\t"
+
+#define MP_STR_(x) #x
+#define MP_STR(x)  MP_STR_(x)
+
+// 本 CPU 的栈顶出栈，空了返回 NULL
+static inline void *rseq_pop(uint8_t *base, size_t stride) {
+    void *ret;
+    long cnt, tmp;
+    __asm__ __volatile__(
+        RSEQ_CS_BEGIN
+        "xorl %k[ret], %k[ret]\n\t"
+        "movl %c[cpu_off](%[rs]), %k[tmp]\n\t"
+        "imulq %[stride], %[tmp]\n\t"
+        "addq %[base], %[tmp]\n\t"
+        "movq (%[tmp]), %[cnt]\n\t"
+        "testq %[cnt], %[cnt]\n\t"
+        "jz 2f\n\t"
+        "movq 8(%[tmp], %[cnt], 8), %[ret]\n\t"   // objects[cnt - 1]
+        "decq %[cnt]\n\t"
+        "movq %[cnt], (%[tmp])\n\t"               // 提交
+        RSEQ_CS_END
+        : [ret] "=&r"(ret), [cnt] "=&r"(cnt), [tmp] "=&r"(tmp)
+        : [rs] "r"(rseq_area()), [base] "r"(base), [stride] "r"(stride),
+          [cs_off] "i"(__builtin_offsetof(struct rseq, rseq_cs)),
+          [cpu_off] "i"(__builtin_offsetof(struct rseq, cpu_id))
+        : "memory", "cc");
+    return ret;
+}
+
+// 压进本 CPU 的栈，满了返回 false
+static inline bool rseq_push(uint8_t *base, size_t stride, void *ptr) {
+    long cnt, tmp;
+    int ok;
+    __asm__ __volatile__(
+        RSEQ_CS_BEGIN
+        "xorl %k[ok], %k[ok]\n\t"
+        "movl %c[cpu_off](%[rs]), %k[tmp]\n\t"
+        "imulq %[stride], %[tmp]\n\t"
+        "addq %[base], %[tmp]\n\t"
+        "movq (%[tmp]), %[cnt]\n\t"
+        "cmpq 8(%[tmp]), %[cnt]\n\t"
+        "jae 2f\n\t"
+        "movq %[ptr], 16(%[tmp], %[cnt], 8)\n\t"  // objects[cnt]，没提交前写了也无妨
+        "incq %[cnt]\n\t"
+        "movl $1, %k[ok]\n\t"
+        "movq %[cnt], (%[tmp])\n\t"               // 提交
+        RSEQ_CS_END
+        : [ok] "=&r"(ok), [cnt] "=&r"(cnt), [tmp] "=&r"(tmp)
+        : [rs] "r"(rseq_area()), [base] "r"(base), [stride] "r"(stride),
+          [ptr] "r"(ptr),
+          [cs_off] "i"(__builtin_offsetof(struct rseq, rseq_cs)),
+          [cpu_off] "i"(__builtin_offsetof(struct rseq, cpu_id))
+        : "memory", "cc");
+    return ok;
 }
 
-void *mp_alloc(void) {
+// 不超过一批的对象装进一个壳还给 depot
+static void percpu_spill(global_pool_t *pool, void **objs, int n) {
+    magazine_t *m = depot_pop(pool, &pool->empty);
+    if (!m)
+        m = mag_alloc(pool);
+
+    memcpy(m->rounds, objs, n * sizeof(void *));
+    m->count = n;
+    depot_push(pool, &pool->full, m, m);
+    depot_count(pool, n);
+    depot_signal(pool);
+}
 
-    assert(t_cache != NULL && "Did you forget mp_thread_init?");
+// 逐个压进当前 CPU；中途迁移到一个满的 CPU 上，剩下的退回 depot
+static void percpu_fill(global_pool_t *pool, void **objs, int n) {
+    int i = 0;
+    while (i < n && rseq_push(pool->percpu, pool->cpu_stride, objs[i]))
+        i++;
+    if (i < n)
+        percpu_spill(pool, objs + i, n - i);
+}
 
-    if (t_cache->count > 0) {
-        t_cache->alloc_cnt++;
-        return t_cache->objects[--t_cache->count];
+static bool percpu_refill(global_pool_t *pool, const struct timespec *deadline) {
+    void *buf[pool->batch];
+    magazine_t *m;
+
+    atomic_fetch_add_explicit(&pool->pc_refill, 1, memory_order_relaxed);
+    while ((m = depot_pop(pool, &pool->full)) == NULL) {
+        int n = pool_carve(pool, buf, pool->batch);
+        if (n > 0) {
+            percpu_fill(pool, buf, n);
+            return true;
+        }
+        unsigned seq = atomic_load(&pool->scav_seq);
+        if (pool_grow(pool))
+            continue;
+        if (!depot_wait(pool, NULL, seq, deadline))
+            return false;
     }
 
-    cache_refill();
-    t_cache->alloc_cnt++;
-    return (t_cache->count > 0) ? t_cache->objects[--t_cache->count] : NULL;
+    depot_count(pool, -m->count);
+    percpu_fill(pool, m->rounds, m->count);
+    depot_push(pool, &pool->empty, m, m);
+    return true;
 }
 
-void mp_free(void *ptr) {
-    if (!ptr) return;
+// 本 CPU 栈满：弹出一批还给 depot
+static void percpu_flush(global_pool_t *pool) {
+    void *buf[pool->batch];
+    int n = 0;
+
+    atomic_fetch_add_explicit(&pool->pc_flush, 1, memory_order_relaxed);
+    while (n < pool->batch && (buf[n] = rseq_pop(pool->percpu, pool->cpu_stride)) != NULL)
+        n++;
+    if (n > 0)
+        percpu_spill(pool, buf, n);
+}
 
-    assert(t_cache != NULL && "Did you forget mp_thread_init?");
+static inline void *percpu_alloc(global_pool_t *pool, const struct timespec *deadline) {
+    void *p;
+    while ((p = rseq_pop(pool->percpu, pool->cpu_stride)) == NULL) {
+        if (!percpu_refill(pool, deadline))
+            return NULL;
+    }
+    return p;
+}
 
-    t_cache->free_cnt++;
+static inline void percpu_free(global_pool_t *pool, void *ptr) {
+    while (!rseq_push(pool->percpu, pool->cpu_stride, ptr))
+        percpu_flush(pool);
 
-    if (t_cache->count < LOCAL_CACHE_CAPACITY) {
-        t_cache->objects[t_cache->count++] = ptr;
-        return;
+    // 有人在等：别让对象停在 CPU 栈上，送一批回 depot
+    if (__builtin_expect(atomic_load_explicit(&pool->waiters, memory_order_relaxed) > 0, 0))
+        percpu_flush(pool);
+}
+#endif
+
+// 内核或 libc 不支持 rseq 时返回 false，pool 走线程 cache
+static bool percpu_init(global_pool_t *pool) {
+#if MP_HAVE_RSEQ
+    if (!rseq_usable())
+        return false;
+
+    int ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpu < 1)
+        return false;
+
+    size_t stride = ALIGN_UP(sizeof(cpu_cache_t) + pool->cache_cap * sizeof(void *), CACHE_LINE);
+    uint8_t *base = aligned_alloc(CACHE_LINE, ncpu * stride);
+    if (!base)
+        return false;
+
+    for (int i = 0; i < ncpu; i++) {
+        cpu_cache_t *cc = (cpu_cache_t *)(base + i * stride);
+        cc->count    = 0;
+        cc->capacity = pool->cache_cap;
     }
+    pool->percpu     = base;
+    pool->cpu_stride = stride;
+    pool->ncpu       = ncpu;
+    return true;
+#else
+    (void)pool;
+    return false;
+#endif
+}
+
+// 取本线程在 pool 上的 cache，没有就现建；id 一次下标、gen 一次比较
+static inline thread_cache_t *cache_get(global_pool_t *pool) {
+    thread_cache_t *tc = t_caches[pool->id];
+    if (__builtin_expect(tc == NULL || tc->gen != pool->gen, 0))
+        tc = cache_bind(pool);
+    return tc;
+}
 
-    cache_flush();
-    t_cache->objects[t_cache->count++] = ptr;
+// 可选：提前建好本线程的 cache，第一次 mp_alloc 就不走慢路径
+void mp_thread_init(global_pool_t *global) {
+    if (!global->percpu)
+        cache_get(global);
 }
 
 /* ==========================================
- * Benchmark
+ * Pool API
  * ========================================== */
 
-#define TEST_THREADS 4
-#define TOTAL_OPS    5000000
-#define POOL_SIZE    100000
+// 对象从 chunk 内第一个不与头部（和属主表）重叠的槽位开始
+static void chunk_layout(size_t obj_sz, bool owner_map, size_t *first, int *per_chunk) {
+    size_t per_obj = obj_sz + (owner_map ? sizeof(uint16_t) : 0);
+    int n = (MP_CHUNK_SIZE - sizeof(chunk_hdr_t)) / per_obj;
+    size_t hdr = sizeof(chunk_hdr_t) + (owner_map ? n * sizeof(uint16_t) : 0);
 
-void *worker(void *arg) {
-    mp_thread_init(arg);
+    *first = DIV_ROUND_UP(hdr, obj_sz) * obj_sz;
+    int fit = (*first < MP_CHUNK_SIZE) ? (MP_CHUNK_SIZE - *first) / obj_sz : 0;
+    *per_chunk = fit < n ? fit : n;
+}
 
-    for (int i = 0; i < TOTAL_OPS; i++) {
-        void *p = mp_alloc();
-        *(int *)p = i;
-        mp_free(p);
+static inline global_pool_t *ptr_to_pool(void *ptr) {
+    chunk_hdr_t *c = (chunk_hdr_t *)ALIGN_DOWN((uintptr_t)ptr, MP_CHUNK_SIZE);
+    return c->pool;
+}
+
+// 预缺页但不改内容：老内核没有 MADV_POPULATE_WRITE 就逐页原子加 0
+static void prefault_range(uint8_t *base, size_t len) {
+    if (madvise(base, len, MADV_POPULATE_WRITE) == 0)
+        return;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t off = 0; off < len; off += page)
+        __atomic_fetch_add(base + off, 0, __ATOMIC_RELAXED);
+}
+
+// 映射 len 字节、按 MP_CHUNK_SIZE 对齐的区域
+static uint8_t *chunk_map(size_t len, int flags) {
+    if (flags & MP_POOL_HUGETLB) {
+        // 2MB 大页的映射天然按 chunk 对齐
+        int populate = (flags & MP_POOL_POPULATE) ? MAP_POPULATE : 0;
+        void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate, -1, 0);
+        if (p != MAP_FAILED)
+            return p;
+    }
+
+    // 多映射一个 chunk，裁掉首尾让起点按 MP_CHUNK_SIZE 对齐
+    uint8_t *raw = mmap(NULL, len + MP_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+
+    uint8_t *base = (uint8_t *)ALIGN_UP((uintptr_t)raw, MP_CHUNK_SIZE);
+    if (base > raw)
+        munmap(raw, base - raw);
+    munmap(base + len, raw + MP_CHUNK_SIZE - base);
+
+    if (flags & (MP_POOL_HUGETLB | MP_POOL_THP))
+        madvise(base, len, MADV_HUGEPAGE);
+    // 放在 MADV_HUGEPAGE 之后，缺页时才能直接拿到大页
+    if (flags & MP_POOL_POPULATE)
+        prefault_range(base, len);
+    return base;
+}
+
+static void chunk_init(global_pool_t *pool, uint8_t *c, size_t map_size) {
+    chunk_hdr_t *hdr = (chunk_hdr_t *)c;
+    hdr->pool = pool;
+    hdr->map_size = map_size;
+    hdr->idle_next = NULL;
+    hdr->scav_cnt = 0;
+    hdr->next = pool->chunks;
+    pool->chunks = hdr;
+}
+
+// 追加 count 个对象：只映射并登记首个 chunk，其余 chunk 切到时才写头部
+// 调用方持有 grow_lock（或处于创建阶段）
+static int pool_map(global_pool_t *pool, int count) {
+    size_t first  = pool->first_obj;
+    size_t len    = DIV_ROUND_UP(count, pool->per_chunk) * MP_CHUNK_SIZE;
+
+    uint8_t *base = chunk_map(len, pool->flags);
+    if (!base) {
+        perror("mmap");
+        return -1;
+    }
+
+    chunk_init(pool, base, len);
+    pool->carve_chunk = base;
+    pool->carve_ptr   = base + first;
+    pool->carve_left  = count;
+    pool->total      += count;
+    return 0;
+}
+
+// 从 bump 区切出最多 n 个从没用过的对象，返回实际个数
+static int pool_carve(global_pool_t *pool, void **out, int n) {
+    size_t obj_sz = pool->obj_size;
+    size_t end    = pool->first_obj + pool->per_chunk * obj_sz;
+    int got = 0;
+
+    pthread_mutex_lock(&pool->grow_lock);
+    while (got < n) {
+        if (pool->carve_left == 0) {
+            // 当前映射段切完了，接着切回收过的 chunk
+            chunk_hdr_t *c = pool->idle;
+            if (!c) break;
+            pool->idle = c->idle_next;
+            pool->idle_cnt--;
+            pool->carve_chunk = (uint8_t *)c;
+            pool->carve_ptr   = (uint8_t *)c + pool->first_obj;
+            pool->carve_left  = pool->per_chunk;
+        }
+        if (pool->carve_ptr >= pool->carve_chunk + end) {
+            pool->carve_chunk += MP_CHUNK_SIZE;
+            chunk_init(pool, pool->carve_chunk, 0);
+            pool->carve_ptr = pool->carve_chunk + pool->first_obj;
+        }
+        out[got++] = pool->carve_ptr;
+        pool->carve_ptr += obj_sz;
+        pool->carve_left--;
     }
+    pthread_mutex_unlock(&pool->grow_lock);
+    return got;
+}
+
+// depot 空了就扩容；返回 false 表示已到上限、映射失败或正在回收，调用方只能等
+static bool pool_grow(global_pool_t *pool) {
+    bool ok = true;
+
+    // depot 空可能只是回收正拿着 magazine 在数：不扩容，调用方按自己的 deadline 去 depot_wait
+    if (pool->grow_count == 0 || (atomic_load(&pool->scav_seq) & 1)) return false;
+
+    pthread_mutex_lock(&pool->grow_lock);
+    // 复查：拿锁期间别人可能已经扩过或归还过
+    if (depot_empty(pool) && pool->carve_left == 0 && !pool->idle) {
+        int n = pool->max_count - pool->total;
+        if (n > pool->grow_count) n = pool->grow_count;
+        ok = n > 0 && pool_map(pool, n) == 0;
+    }
+    pthread_mutex_unlock(&pool->grow_lock);
+    return ok;
+}
+
+// 整块空闲的 chunk 还给内核：depot 整个倒出来按 chunk 计数，凑满 per_chunk 的摘出来
+// madvise 后挂到 idle，之后 pool_carve 重新切；保留 retain 个空闲对象常驻
+// 线程 / CPU cache 里的对象不参与，所在 chunk 这一轮不回收。返回回收的 chunk 数
+int mp_pool_scavenge(global_pool_t *pool, int retain) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    int advice  = (pool->flags & MP_POOL_MADV_FREE) ? MADV_FREE : MADV_DONTNEED;
+    int nmag = 0, nobj = 0;
+    magazine_t *m;
+
+    pthread_mutex_lock(&pool->scav_lock);
+    atomic_fetch_add(&pool->scav_seq, 1);
+
+    // 1. depot 整个倒出来，壳按顺序放进数组
+    int cap = 64;
+    magazine_t **mags = malloc(cap * sizeof(*mags));
+    while (mags && (m = depot_pop(pool, &pool->full)) != NULL) {
+        if (nmag == cap) {
+            magazine_t **tmp = realloc(mags, (cap *= 2) * sizeof(*mags));
+            if (!tmp) {
+                depot_push(pool, &pool->full, m, m);
+                break;
+            }
+            mags = tmp;
+        }
+        mags[nmag++] = m;
+        nobj += m->count;
+    }
+    if (!mags) {
+        atomic_fetch_add(&pool->scav_seq, 1);
+        depot_signal(pool);
+        pthread_mutex_unlock(&pool->scav_lock);
+        return 0;
+    }
+    depot_count(pool, -nobj);
+
+    // 2. 头部常驻，顺手当计数器；只有持 scav_lock 的人碰
+    for (int k = 0; k < nmag; k++)
+        for (int i = 0; i < mags[k]->count; i++)
+            ((chunk_hdr_t *)ALIGN_DOWN((uintptr_t)mags[k]->rounds[i], MP_CHUNK_SIZE))->scav_cnt++;
+
+    // 3. 挑出整块空闲的 chunk，标 -1
+    chunk_hdr_t *victims = NULL;
+    int released = 0, left = nobj;
+    pthread_mutex_lock(&pool->grow_lock);
+    for (chunk_hdr_t *c = pool->chunks; c; c = c->next) {
+        if (c->scav_cnt == pool->per_chunk && left - pool->per_chunk >= retain) {
+            c->scav_cnt  = -1;
+            c->idle_next = victims;
+            victims = c;
+            left -= pool->per_chunk;
+            released++;
+        } else {
+            c->scav_cnt = 0;
+        }
+    }
+    pthread_mutex_unlock(&pool->grow_lock);
+
+    // 4. 剩下的原地压紧：写位置不会跑到读位置前面
+    int wk = 0, wi = 0;
+    for (int k = 0; k < nmag; k++) {
+        int cnt = mags[k]->count;
+        for (int i = 0; i < cnt; i++) {
+            void *p = mags[k]->rounds[i];
+            if (((chunk_hdr_t *)ALIGN_DOWN((uintptr_t)p, MP_CHUNK_SIZE))->scav_cnt < 0)
+                continue;
+            if (wi == pool->batch) {
+                mags[wk++]->count = wi;
+                wi = 0;
+            }
+            mags[wk]->rounds[wi++] = p;
+        }
+    }
+    if (nmag > 0) {
+        mags[wk]->count = wi;
+        if (wi > 0) wk++;
+    }
+    for (int k = 0; k < nmag; k++) {
+        if (k < wk)
+            depot_push(pool, &pool->full, mags[k], mags[k]);
+        else
+            depot_push(pool, &pool->empty, mags[k], mags[k]);
+    }
+    depot_count(pool, left);
+    if (left > 0)
+        depot_signal(pool);
+    free(mags);
+
+    // 5. 头部那一页不动，对象区整页还掉；之后才让 pool_carve 看到
+    chunk_hdr_t *c = victims, *last = NULL;
+    for (; c; last = c, c = c->idle_next) {
+        c->scav_cnt = 0;
+        uint8_t *from = (uint8_t *)ALIGN_UP((uintptr_t)c + pool->first_obj, page);
+        uint8_t *to   = (uint8_t *)c + MP_CHUNK_SIZE;
+        if (from < to)
+            madvise(from, to - from, advice);   // 大页映射不支持部分释放，失败就只是不省内存
+    }
+    if (victims) {
+        pthread_mutex_lock(&pool->grow_lock);
+        last->idle_next = pool->idle;
+        pool->idle = victims;
+        pool->idle_cnt += released;
+        pthread_mutex_unlock(&pool->grow_lock);
+    }
+    // idle 挂好才放开扩容，再叫醒这期间等着的（depot 可能全回收了，要去切 idle）
+    atomic_fetch_add(&pool->scav_seq, 1);
+    depot_signal(pool);
+
+    pthread_mutex_unlock(&pool->scav_lock);
+    return released;
+}
+
+// 后台回收：每 scav_ms 醒一次，destroy 时叫停
+static void *scavenger_main(void *arg) {
+    global_pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->scav_lock);
+    while (!pool->scav_stop) {
+        struct timespec ts = ns_to_ts(mono_ns() + pool->scav_ms * 1000000LL);
+        pthread_cond_timedwait(&pool->scav_cond, &pool->scav_lock, &ts);
+        if (pool->scav_stop)
+            break;
+        pthread_mutex_unlock(&pool->scav_lock);
+        mp_pool_scavenge(pool, pool->retain);
+        pthread_mutex_lock(&pool->scav_lock);
+    }
+    pthread_mutex_unlock(&pool->scav_lock);
     return NULL;
 }
 
-int main(void) {
-    global_pool_t *pool = mp_pool_create(POOL_SIZE);
+// 分配 pool id，表满返回 -1
+static int pool_register(global_pool_t *pool) {
+    int id = -1;
+
+    pthread_mutex_lock(&g_pools_lock);
+    for (int i = 0; i < MP_MAX_POOLS; i++) {
+        if (!g_pools[i]) {
+            id = i;
+            g_pools[i] = pool;
+            pool->id  = i;
+            pool->gen = ++g_pool_gen;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_pools_lock);
+    return id;
+}
 
-    pthread_t th[TEST_THREADS];
-    struct timespec s, e;
-    clock_gettime(CLOCK_MONOTONIC, &s);
+static global_pool_t *pool_create(const mp_pool_attr_t *attr, int class_idx) {
+    pthread_once(&key_once, make_cleanup_key);
+
+    size_t obj_size = attr->obj_size   ? attr->obj_size       : OBJECT_SIZE;
+    int cache_cap   = attr->cache_capacity ? attr->cache_capacity : LOCAL_CACHE_CAPACITY;
+    int batch       = attr->batch_size ? attr->batch_size     : BATCH_SIZE;
+
+    // flush 留一半，批不能比半个 cache 还大
+    size_t first;
+    int per_chunk;
+    obj_size = ALIGN_UP(obj_size, CACHE_LINE);
+    chunk_layout(obj_size, attr->flags & MP_POOL_REMOTE_FREE, &first, &per_chunk);
+    if (per_chunk < 1 || batch < 1 || cache_cap < 2 * batch)
+        return NULL;
+    // 每 CPU cache 没有属主的概念
+    if ((attr->flags & MP_POOL_PERCPU) && (attr->flags & MP_POOL_REMOTE_FREE))
+        return NULL;
+
+    size_t sz = ALIGN_UP(sizeof(global_pool_t), CACHE_LINE); /* FIX-6 */
+    global_pool_t *pool = aligned_alloc(CACHE_LINE, sz);
+    if (!pool) return NULL;
+
+    if (pool_register(pool) < 0) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_spin_init(&pool->lock, PTHREAD_PROCESS_PRIVATE);
+    pthread_mutex_init(&pool->wait_lock, NULL);
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->wait_cond, &ca);
+    pthread_condattr_destroy(&ca);
+    atomic_init(&pool->waiters, 0);
+    atomic_init(&pool->efd, -1);
+    atomic_init(&pool->notify, 0);
+    atomic_init(&pool->full, 0);
+    atomic_init(&pool->empty, 0);
+    atomic_init(&pool->depot_objs, 0);
+    atomic_init(&pool->cache_limits, 0);
+    pool->depot_mode = attr->depot_mode;
+    pthread_mutex_init(&pool->mag_lock, NULL);
+    pool->mag_blocks = NULL;
+    pthread_mutex_init(&pool->grow_lock, NULL);
+    pool->chunks = NULL;
+    pool->total  = 0;
+    pool->carve_chunk = NULL;
+    pool->carve_ptr   = NULL;
+    pool->carve_left  = 0;
+
+    pool->idle = NULL;
+    pool->idle_cnt = 0;
+    pool->scav_ms = attr->scavenge_ms;
+    pool->retain = attr->retain_count;
+    pool->scav_stop = false;
+    atomic_init(&pool->scav_seq, 0);
+    pthread_mutex_init(&pool->scav_lock, NULL);
+    pthread_condattr_t sca;
+    pthread_condattr_init(&sca);
+    pthread_condattr_setclock(&sca, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->scav_cond, &sca);
+    pthread_condattr_destroy(&sca);
+
+    pthread_mutex_init(&pool->stats_lock, NULL);
+    pool->caches = NULL;
+    memset(&pool->retired, 0, sizeof(pool->retired));
+    atomic_init(&pool->pc_refill, 0);
+    atomic_init(&pool->pc_flush, 0);
+    atomic_init(&pool->spin_ns, 0);
+    atomic_init(&pool->wait_ns, 0);
+
+    pool->obj_size   = obj_size;
+    pool->first_obj  = first;
+    pool->per_chunk  = per_chunk;
+    pool->cache_cap  = cache_cap;
+    pool->batch      = batch;
+    pool->mag_size   = ALIGN_UP(sizeof(magazine_t) + batch * sizeof(void *), sizeof(void *));
+    pool->class_idx  = class_idx;
+    pool->grow_count = attr->grow_count;
+    pool->max_count  = attr->max_count > attr->init_count ? attr->max_count : attr->init_count;
+    // 默认让各线程 cache 合计能囤到 pool 的一半：线程多的时候热线程照样涨得到工作集
+    pool->cache_budget = attr->cache_budget ? attr->cache_budget : (long)cache_cap * MP_CACHE_BUDGET_MUL;
+    if (!attr->cache_budget && pool->cache_budget < pool->max_count / 2)
+        pool->cache_budget = pool->max_count / 2;
+    pool->flags      = attr->flags;
+
+    pool->remote = NULL;
+    atomic_init(&pool->owners_hw, 0);
+    if (attr->flags & MP_POOL_REMOTE_FREE) {
+        pool->remote = aligned_alloc(CACHE_LINE, MP_MAX_OWNERS * sizeof(remote_queue_t));
+        for (int i = 0; pool->remote && i < MP_MAX_OWNERS; i++)
+            remote_queue_init(&pool->remote[i]);
+    }
+
+    pool->percpu = NULL;
+    pool->cpu_stride = 0;
+    pool->ncpu = 0;
+    if (attr->flags & MP_POOL_PERCPU)
+        percpu_init(pool);
+
+    if (attr->init_count > 0 && pool_map(pool, attr->init_count) < 0)
+        exit(1);
+
+    if (pool->scav_ms > 0 &&
+        pthread_create(&pool->scav_thread, NULL, scavenger_main, pool) != 0)
+        pool->scav_ms = 0;
+
+    return pool;
+}
+
+// 参数不合法或 pool id 用完返回 NULL
+global_pool_t *mp_pool_create_ex(const mp_pool_attr_t *attr) {
+    return pool_create(attr, -1);
+}
+
+global_pool_t *mp_pool_create(int count) {
+    mp_pool_attr_t attr = { .init_count = count };
+    return pool_create(&attr, -1);
+}
+
+typedef struct {
+    uint8_t  **chunks;
+    int        nchunks;
+    atomic_int next;
+} prefault_job_t;
+
+static void *prefault_worker(void *arg) {
+    prefault_job_t *job = arg;
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->nchunks)
+        prefault_range(job->chunks[i], MP_CHUNK_SIZE);
+    return NULL;
+}
+
+// 多线程按 chunk 分活并行预缺页，不改内容，pool 使用中也可以调
+void mp_pool_prefault(global_pool_t *pool, int nthreads) {
+    prefault_job_t job = { .chunks = NULL, .nchunks = 0 };
+    atomic_init(&job.next, 0);
+
+    // 登记表里每段的首个 chunk 带着整段长度
+    pthread_mutex_lock(&pool->grow_lock);
+    int cap = 0;
+    for (chunk_hdr_t *c = pool->chunks; c; c = c->next)
+        cap += c->map_size / MP_CHUNK_SIZE;
+    job.chunks = malloc(cap * sizeof(uint8_t *));
+    for (chunk_hdr_t *c = pool->chunks; c && job.chunks; c = c->next) {
+        for (size_t off = 0; off < c->map_size; off += MP_CHUNK_SIZE)
+            job.chunks[job.nchunks++] = (uint8_t *)c + off;
+    }
+    pthread_mutex_unlock(&pool->grow_lock);
+
+    if (!job.chunks) return;
+    if (nthreads < 1) nthreads = 1;
 
-    for (int i = 0; i < TEST_THREADS; i++)
-        pthread_create(&th[i], NULL, worker, pool);
-    for (int i = 0; i < TEST_THREADS; i++)
+    pthread_t th[nthreads];
+    for (int i = 0; i < nthreads; i++)
+        pthread_create(&th[i], NULL, prefault_worker, &job);
+    for (int i = 0; i < nthreads; i++)
         pthread_join(th[i], NULL);
 
-    clock_gettime(CLOCK_MONOTONIC, &e);
-    double sec = (e.tv_sec - s.tv_sec) +
-                 (e.tv_nsec - s.tv_nsec) / 1e9;
+    free(job.chunks);
+}
 
-    printf("Time: %.3f s\n", sec);
-    printf("Rate: %.2f Mops/s\n",
-           (TEST_THREADS * TOTAL_OPS * 2.0) / 1e6 / sec);
+// 其他线程里残留的 cache 靠 gen 识别，之后直接丢弃
+void mp_pool_destroy(global_pool_t *pool) {
+    if (!pool) return;
+    if (pool->class_idx >= 0)
+        g_classes[pool->class_idx] = NULL;
+
+    if (pool->scav_ms > 0) {
+        pthread_mutex_lock(&pool->scav_lock);
+        pool->scav_stop = true;
+        pthread_cond_signal(&pool->scav_cond);
+        pthread_mutex_unlock(&pool->scav_lock);
+        pthread_join(pool->scav_thread, NULL);
+    }
 
-    mp_pool_destroy(pool);
+    pthread_mutex_lock(&g_pools_lock);
+    g_pools[pool->id] = NULL;
+    pthread_mutex_unlock(&g_pools_lock);
+
+    // 先摘出每段的起点再 munmap，头部本身就在被释放的内存里
+    chunk_hdr_t *c = pool->chunks;
+    while (c) {
+        chunk_hdr_t *next = c->next;
+        if (c->map_size)
+            munmap(c, c->map_size);
+        c = next;
+    }
+
+    mag_block_t *blk = pool->mag_blocks;
+    while (blk) {
+        mag_block_t *next = blk->next;
+        free(blk);
+        blk = next;
+    }
+
+    free(pool->remote);
+    free(pool->percpu);
+    pthread_spin_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->mag_lock);
+    pthread_mutex_destroy(&pool->grow_lock);
+    pthread_mutex_destroy(&pool->wait_lock);
+    pthread_cond_destroy(&pool->wait_cond);
+    pthread_mutex_destroy(&pool->stats_lock);
+    pthread_mutex_destroy(&pool->scav_lock);
+    pthread_cond_destroy(&pool->scav_cond);
+    if (atomic_load(&pool->efd) >= 0)
+        close(atomic_load(&pool->efd));
+    free(pool);
+}
+
+// 事件循环用：mp_try_alloc / mp_alloc_timed 失败后，对象回到 pool 时 fd 变为可读
+// 可读后先 read 清零再重试分配；fd 归 pool 所有，destroy 时关闭
+int mp_pool_eventfd(global_pool_t *pool) {
+    pthread_mutex_lock(&pool->wait_lock);
+    int fd = atomic_load(&pool->efd);
+    if (fd < 0) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        atomic_store(&pool->efd, fd);
+    }
+    pthread_mutex_unlock(&pool->wait_lock);
+    return fd;
+}
+
+// 随时可调，只读 relaxed 计数，不打断分配路径
+void mp_pool_stats(global_pool_t *pool, mp_pool_stats_t *st) {
+    memset(st, 0, sizeof(*st));
+    st->obj_size = pool->obj_size;
+
+    pthread_mutex_lock(&pool->grow_lock);
+    st->total    = pool->total;
+    st->uncarved = pool->carve_left + pool->idle_cnt * pool->per_chunk;
+    pthread_mutex_unlock(&pool->grow_lock);
+    st->high_water = st->total - st->uncarved;
+    st->depot_free = atomic_load_explicit(&pool->depot_objs, memory_order_relaxed);
+    st->cache_limit = atomic_load_explicit(&pool->cache_limits, memory_order_relaxed);
+
+    mp_counters_t sum = { 0 };
+    pthread_mutex_lock(&pool->stats_lock);
+    counters_add(&sum, &pool->retired);
+    for (thread_cache_t *tc = pool->caches; tc; tc = tc->sib_next) {
+        counters_add(&sum, &tc->st);
+        st->cached += __atomic_load_n(&tc->count, __ATOMIC_RELAXED);
+        st->threads++;
+    }
+    pthread_mutex_unlock(&pool->stats_lock);
+
+    for (int i = 0; i < pool->ncpu; i++) {
+        cpu_cache_t *cc = (cpu_cache_t *)(pool->percpu + i * pool->cpu_stride);
+        st->cached += __atomic_load_n(&cc->count, __ATOMIC_RELAXED);
+    }
+    sum.refill += atomic_load_explicit(&pool->pc_refill, memory_order_relaxed);
+    sum.flush  += atomic_load_explicit(&pool->pc_flush, memory_order_relaxed);
+
+    st->in_use = st->high_water - st->depot_free - st->cached;
+    if (st->in_use < 0)
+        st->in_use = 0;
+    st->alloc_cnt  = sum.alloc;
+    st->free_cnt   = sum.free;
+    st->refill_cnt = sum.refill;
+    st->flush_cnt  = sum.flush;
+    st->remote_cnt = sum.remote;
+    st->wait_cnt   = sum.wait;
+    st->spin_ns    = atomic_load_explicit(&pool->spin_ns, memory_order_relaxed);
+    st->wait_ns    = atomic_load_explicit(&pool->wait_ns, memory_order_relaxed);
+}
+
+static inline void *cache_alloc(thread_cache_t *tc, const struct timespec *deadline) {
+    if (tc->count == 0) {
+        cache_refill(tc, deadline);
+        if (tc->count == 0) return NULL;
+    }
+
+    STAT_INC(tc->st.alloc);
+    int n = tc->count - 1;
+    void *ptr = tc->objects[n];
+    CACHE_SET_COUNT(tc, n);
+    // 没认领到槽位的线程写 0，免得别人把对象送给上一任属主
+    if (tc->track_owner)
+        *obj_owner(tc->global, ptr) = tc->owner;
+    return ptr;
+}
+
+static inline void cache_free(thread_cache_t *tc, void *ptr) {
+    STAT_INC(tc->st.free);
+
+    // 别人分配的对象直接送回属主的队列，不在本线程囤积
+    if (tc->track_owner) {
+        uint16_t owner = *obj_owner(tc->global, ptr);
+        if (owner && owner != tc->owner) {
+            STAT_INC(tc->st.remote);
+            remote_stash(tc, owner, ptr);
+            return;
+        }
+    }
+
+    if (tc->count < tc->limit) {
+        tc->objects[tc->count] = ptr;
+        CACHE_SET_COUNT(tc, tc->count + 1);
+        return;
+    }
+
+    // 满得勤就先涨容量，涨不动再 flush
+    if (!cache_adapt(tc, true))
+        cache_flush(tc);
+    tc->objects[tc->count] = ptr;
+    CACHE_SET_COUNT(tc, tc->count + 1);
+}
+
+void *mp_alloc(global_pool_t *pool) {
+#if MP_HAVE_RSEQ
+    if (pool->percpu)
+        return percpu_alloc(pool, NULL);
+#endif
+    return cache_alloc(cache_get(pool), NULL);
+}
+
+// 失败后登记通知；登记前刚好有对象回来就立刻写，免得事件循环干等
+static void notify_arm(global_pool_t *pool, remote_queue_t *rq) {
+    if (atomic_load_explicit(&pool->efd, memory_order_relaxed) < 0) return;
+
+    atomic_store(&pool->notify, 1);
+    if (!depot_empty(pool) || (rq && remote_pending(rq)))
+        notify_fire(pool);
+}
+
+static void *alloc_until(global_pool_t *pool, const struct timespec *deadline) {
+    void *p;
+    remote_queue_t *rq = NULL;
+#if MP_HAVE_RSEQ
+    if (pool->percpu) {
+        p = percpu_alloc(pool, deadline);
+    } else
+#endif
+    {
+        thread_cache_t *tc = cache_get(pool);
+        p  = cache_alloc(tc, deadline);
+        rq = tc->rq;
+    }
+
+    if (!p)
+        notify_arm(pool, rq);
+    return p;
+}
+
+// pool 空了立即返回 NULL，不睡；配合 mp_pool_eventfd 在事件循环里用
+void *mp_try_alloc(global_pool_t *pool) {
+    static const struct timespec past = { 0, 0 };
+    return alloc_until(pool, &past);
+}
+
+// deadline 是 CLOCK_MONOTONIC 绝对时间，到点还没有对象返回 NULL
+void *mp_alloc_timed(global_pool_t *pool, const struct timespec *deadline) {
+    return alloc_until(pool, deadline);
+}
+
+void mp_free(global_pool_t *pool, void *ptr) {
+    if (!ptr) return;
+
+    assert(ptr_to_pool(ptr) == pool && "object freed to the wrong pool");
+
+#if MP_HAVE_RSEQ
+    if (pool->percpu) {
+        percpu_free(pool, ptr);
+        return;
+    }
+#endif
+    cache_free(cache_get(pool), ptr);
+}
+
+/* ==========================================
+ * Size Class API
+ * ========================================== */
+
+// size -> class 下标；超过 MP_MAX_SIZED 返回 -1
+static inline int size_to_class(size_t size) {
+    if (size <= (1UL << MP_MIN_SHIFT)) return 0;
+    if (size > MP_MAX_SIZED) return -1;
+    int shift = 64 - __builtin_clzl(size - 1);  // 向上取到 2 的幂
+    return shift - MP_MIN_SHIFT;
+}
+
+// counts[i] 是第 i 级（64 << i 字节）的对象个数，0 表示不启用
+void mp_sizeclass_init(const int counts[MP_NUM_CLASSES]) {
+    for (int i = 0; i < MP_NUM_CLASSES; i++) {
+        if (counts[i] <= 0 || g_classes[i]) continue;
+
+        mp_pool_attr_t attr = {
+            .obj_size   = 1UL << (MP_MIN_SHIFT + i),
+            .init_count = counts[i],
+        };
+        g_classes[i] = pool_create(&attr, i);
+    }
+}
+
+void mp_sizeclass_destroy(void) {
+    for (int i = 0; i < MP_NUM_CLASSES; i++)
+        mp_pool_destroy(g_classes[i]);
+}
+
+// 按 size 挑 class 分配，还的时候用 mp_free_ptr
+void *mp_alloc_sized(size_t size) {
+    int idx = size_to_class(size);
+    if (idx < 0 || !g_classes[idx]) return NULL;
+
+    return mp_alloc(g_classes[idx]);
+}
+
+// 只要指针：chunk 头部记录了归属 pool，任何 pool 的对象都能这样还
+void mp_free_ptr(void *ptr) {
+    if (!ptr) return;
+
+    mp_free(ptr_to_pool(ptr), ptr);
+}
+
+/* ==========================================
+ * 共享内存 Pool（多进程）
+ * ========================================== */
+
+// 整个 pool 放在一段 memfd 里，各进程映射地址可以不同：
+// 共享部分只存下标和偏移，进程私有的句柄和线程 cache 存指针
+#define MP_SHM_MAGIC      0x6d705f73686d3031ULL   // "mp_shm01"
+#define MP_MAX_SHM        16
+#define MP_SHM_CACHE      (BATCH_SIZE * 4)        // 线程 cache 容量，跨进程囤积要少
+
+// 空闲对象自身的头部：同一批串成一条链，链头再串成栈
+typedef struct {
+    uint32_t         next;          // 链内下一个对象（下标 + 1，0 表示链尾）
+    uint32_t         count;         // 仅链头：本链对象数
+    _Atomic uint32_t next_chain;    // 仅链头：栈里下一条链的链头
+} shm_node_t;
+
+typedef struct {
+    uint64_t magic;
+    size_t   map_size;
+    size_t   obj_size;
+    size_t   first_obj;     // 对象区相对映射起点的偏移
+    uint32_t count;
+    uint32_t batch;
+
+    __attribute__((aligned(CACHE_LINE)))
+    _Atomic uint64_t top;   // 高 32 位版本号，低 32 位链头下标 + 1
+    _Atomic uint32_t carve; // 从没发出去过的对象从这个下标开始
+
+    __attribute__((aligned(CACHE_LINE)))
+    pthread_mutex_t  wait_lock;   // PTHREAD_PROCESS_SHARED + ROBUST
+    pthread_cond_t   wait_cond;
+    atomic_int       waiters;
+} shm_hdr_t;
+
+// 进程私有的句柄
+typedef struct mp_shm_pool {
+    shm_hdr_t *hdr;
+    uint8_t   *objs;
+    int        fd;
+    int        slot;        // t_shm 下标
+    uint64_t   gen;
+} mp_shm_pool_t;
+
+typedef struct shm_cache {
+    mp_shm_pool_t    *pool;
+    uint64_t          gen;
+    int               count;
+    struct shm_cache *next;
+    void             *objs[MP_SHM_CACHE];
+} shm_cache_t;
+
+static __thread shm_cache_t *t_shm[MP_MAX_SHM];
+static __thread shm_cache_t *t_shm_list;
+static mp_shm_pool_t *g_shm[MP_MAX_SHM];      // g_pools_lock 保护
+static pthread_key_t  shm_key;
+static pthread_once_t shm_once = PTHREAD_ONCE_INIT;
+
+static inline shm_node_t *shm_node(shm_hdr_t *h, uint8_t *objs, uint32_t idx) {
+    return (shm_node_t *)(objs + (size_t)idx * h->obj_size);
+}
+
+static inline uint32_t shm_index(mp_shm_pool_t *pool, void *p) {
+    return ((uint8_t *)p - pool->objs) / pool->hdr->obj_size;
+}
+
+// 持锁的进程死了也能接着用
+static void shm_lock(shm_hdr_t *h) {
+    if (pthread_mutex_lock(&h->wait_lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&h->wait_lock);
+}
+
+static void shm_signal(shm_hdr_t *h) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&h->waiters, memory_order_relaxed) == 0)
+        return;
+
+    shm_lock(h);
+    pthread_cond_broadcast(&h->wait_cond);
+    pthread_mutex_unlock(&h->wait_lock);
+}
+
+// objs[0..n) 串成一条链，一次 CAS 压栈
+static void shm_push(mp_shm_pool_t *pool, void **objs, int n) {
+    shm_hdr_t *h = pool->hdr;
+
+    for (int i = 0; i < n; i++) {
+        shm_node_t *node = objs[i];
+        node->next = (i + 1 < n) ? shm_index(pool, objs[i + 1]) + 1 : 0;
+    }
+    shm_node_t *head = objs[0];
+    head->count = n;
+    uint32_t self = shm_index(pool, objs[0]) + 1;
+
+    uint64_t old = atomic_load_explicit(&h->top, memory_order_relaxed);
+    uint64_t new;
+    do {
+        atomic_store_explicit(&head->next_chain, (uint32_t)old, memory_order_relaxed);
+        new = (old & ~0xffffffffULL) | self;
+    } while (!atomic_compare_exchange_weak_explicit(&h->top, &old, new,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+    shm_signal(h);
+}
+
+// 整条链弹出来，拆进 out；栈空返回 0
+static int shm_pop(mp_shm_pool_t *pool, void **out) {
+    shm_hdr_t *h = pool->hdr;
+    uint64_t old = atomic_load_explicit(&h->top, memory_order_acquire);
+    uint64_t new;
+    uint32_t head;
+
+    do {
+        head = (uint32_t)old;
+        if (!head) return 0;
+        // 链头可能已被别的进程弹走并写了数据，读到脏值时版本号会让 CAS 失败
+        uint32_t next = atomic_load_explicit(&shm_node(h, pool->objs, head - 1)->next_chain,
+                                             memory_order_relaxed);
+        new = (((old >> 32) + 1) << 32) | next;
+    } while (!atomic_compare_exchange_weak_explicit(&h->top, &old, new,
+                                                    memory_order_acquire,
+                                                    memory_order_acquire));
+
+    int n = 0;
+    for (uint32_t i = head; i; i = shm_node(h, pool->objs, i - 1)->next)
+        out[n++] = shm_node(h, pool->objs, i - 1);
+    return n;
+}
+
+static void shm_cache_flush(shm_cache_t *c, int keep) {
+    while (c->count > keep) {
+        int n = c->count - keep;
+        if (n > (int)c->pool->hdr->batch)
+            n = c->pool->hdr->batch;
+        c->count -= n;
+        shm_push(c->pool, &c->objs[c->count], n);
+    }
+}
+
+static void shm_cache_refill(shm_cache_t *c) {
+    mp_shm_pool_t *pool = c->pool;
+    shm_hdr_t *h = pool->hdr;
+
+    for (;;) {
+        if ((c->count = shm_pop(pool, c->objs)) > 0)
+            return;
+
+        // 还没切完就从 bump 区拿一批；先看一眼，切完后等待者反复加会绕回
+        uint32_t first = h->count;
+        if (atomic_load_explicit(&h->carve, memory_order_relaxed) < h->count)
+            first = atomic_fetch_add(&h->carve, h->batch);
+        if (first < h->count) {
+            uint32_t n = h->count - first < h->batch ? h->count - first : h->batch;
+            for (uint32_t i = 0; i < n; i++)
+                c->objs[i] = shm_node(h, pool->objs, first + i);
+            c->count = n;
+            return;
+        }
+
+        shm_lock(h);
+        atomic_fetch_add(&h->waiters, 1);
+        if ((uint32_t)atomic_load(&h->top) == 0 &&
+            pthread_cond_wait(&h->wait_cond, &h->wait_lock) == EOWNERDEAD)
+            pthread_mutex_consistent(&h->wait_lock);
+        atomic_fetch_sub(&h->waiters, 1);
+        pthread_mutex_unlock(&h->wait_lock);
+    }
+}
+
+static bool shm_live(shm_cache_t *c) {
+    pthread_mutex_lock(&g_pools_lock);
+    bool live = g_shm[c->pool->slot] == c->pool && c->pool->gen == c->gen;
+    pthread_mutex_unlock(&g_pools_lock);
+    return live;
+}
+
+// 本线程的全部共享 pool cache 清空；句柄已经 detach 的直接丢
+static void shm_flush_all(void) {
+    for (shm_cache_t *c = t_shm_list; c; c = c->next) {
+        if (c->count && shm_live(c))
+            shm_cache_flush(c, 0);
+        c->count = 0;
+    }
+}
+
+static void shm_thread_exit(void *arg) {
+    (void)arg;
+    shm_flush_all();
+    while (t_shm_list) {
+        shm_cache_t *next = t_shm_list->next;
+        free(t_shm_list);
+        t_shm_list = next;
+    }
+    memset(t_shm, 0, sizeof(t_shm));
+}
+
+// fork 只复制调用线程：先把它 cache 里的对象还回去，免得父子进程各拿一份
+static void shm_prefork(void) {
+    shm_flush_all();
+}
+
+static void shm_init_once(void) {
+    pthread_key_create(&shm_key, shm_thread_exit);
+    pthread_atfork(shm_prefork, NULL, NULL);
+}
+
+static shm_cache_t *shm_cache_get(mp_shm_pool_t *pool) {
+    shm_cache_t *c = t_shm[pool->slot];
+    if (__builtin_expect(c != NULL && c->pool == pool && c->gen == pool->gen, 1))
+        return c;
+
+    if (!c) {
+        c = calloc(1, sizeof(*c));
+        if (!c) {
+            fprintf(stderr, "shm cache alloc failed\n");
+            abort();
+        }
+        c->next = t_shm_list;
+        t_shm_list = c;
+        t_shm[pool->slot] = c;
+        pthread_setspecific(shm_key, c);
+    }
+    // 槽位被新句柄复用：旧句柄的对象没法再还，只清零
+    c->pool  = pool;
+    c->gen   = pool->gen;
+    c->count = 0;
+    return c;
+}
+
+static mp_shm_pool_t *shm_open_handle(int fd, shm_hdr_t *h) {
+    pthread_once(&shm_once, shm_init_once);
+
+    mp_shm_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pool->hdr  = h;
+    pool->objs = (uint8_t *)h + h->first_obj;
+    pool->fd   = fd;
+    pool->slot = -1;
+
+    pthread_mutex_lock(&g_pools_lock);
+    for (int i = 0; i < MP_MAX_SHM; i++) {
+        if (!g_shm[i]) {
+            g_shm[i]   = pool;
+            pool->slot = i;
+            pool->gen  = ++g_pool_gen;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_pools_lock);
+
+    if (pool->slot < 0) {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// 新建一个共享 pool；别的进程 fork 继承或拿到 fd 后 mp_shm_pool_attach
+mp_shm_pool_t *mp_shm_pool_create(const char *name, size_t obj_size, int count) {
+    obj_size = ALIGN_UP(obj_size < sizeof(shm_node_t) ? sizeof(shm_node_t) : obj_size, CACHE_LINE);
+    if (count < 1 || (uint64_t)count >= UINT32_MAX)
+        return NULL;
+
+    size_t first = ALIGN_UP(sizeof(shm_hdr_t), CACHE_LINE);
+    size_t size  = ALIGN_UP(first + (size_t)count * obj_size, sysconf(_SC_PAGESIZE));
+
+    int fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd < 0) {
+        perror("memfd_create");
+        return NULL;
+    }
+    if (ftruncate(fd, size) < 0) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    shm_hdr_t *h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return NULL;
+    }
+
+    h->map_size  = size;
+    h->obj_size  = obj_size;
+    h->first_obj = first;
+    h->count     = count;
+    h->batch     = BATCH_SIZE;
+    atomic_init(&h->top, 0);
+    atomic_init(&h->carve, 0);
+    atomic_init(&h->waiters, 0);
+
+    pthread_mutexattr_t ma;
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&h->wait_lock, &ma);
+    pthread_mutexattr_destroy(&ma);
+
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&h->wait_cond, &ca);
+    pthread_condattr_destroy(&ca);
+
+    // 其余字段都写好了才让 attach 的人看到 magic
+    atomic_thread_fence(memory_order_release);
+    h->magic = MP_SHM_MAGIC;
+
+    mp_shm_pool_t *pool = shm_open_handle(fd, h);
+    if (!pool) {
+        munmap(h, size);
+        close(fd);
+    }
+    return pool;
+}
+
+// 映射一个已有的共享 pool，fd 归句柄所有
+mp_shm_pool_t *mp_shm_pool_attach(int fd) {
+    shm_hdr_t probe;
+    if (pread(fd, &probe, sizeof(probe), 0) != (ssize_t)sizeof(probe) ||
+        probe.magic != MP_SHM_MAGIC)
+        return NULL;
+
+    shm_hdr_t *h = mmap(NULL, probe.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    mp_shm_pool_t *pool = shm_open_handle(fd, h);
+    if (!pool)
+        munmap(h, probe.map_size);
+    return pool;
+}
+
+int mp_shm_pool_fd(mp_shm_pool_t *pool) {
+    return pool->fd;
+}
+
+// 本进程不再使用：先还掉调用线程 cache 里的对象，其余线程应已退出
+// 所有进程都关掉 fd 并解除映射后，内核回收内存
+void mp_shm_pool_detach(mp_shm_pool_t *pool) {
+    if (!pool) return;
+
+    shm_cache_t *c = t_shm[pool->slot];
+    if (c && c->pool == pool && c->gen == pool->gen)
+        shm_cache_flush(c, 0);
+
+    pthread_mutex_lock(&g_pools_lock);
+    g_shm[pool->slot] = NULL;
+    pthread_mutex_unlock(&g_pools_lock);
+
+    munmap(pool->hdr, pool->hdr->map_size);
+    close(pool->fd);
+    free(pool);
+}
+
+void *mp_shm_alloc(mp_shm_pool_t *pool) {
+    shm_cache_t *c = shm_cache_get(pool);
+    if (c->count == 0)
+        shm_cache_refill(c);
+    return c->objs[--c->count];
+}
+
+void mp_shm_free(mp_shm_pool_t *pool, void *ptr) {
+    if (!ptr) return;
+
+    assert((uint8_t *)ptr >= pool->objs &&
+           shm_index(pool, ptr) < pool->hdr->count && "object freed to the wrong shm pool");
+
+    shm_cache_t *c = shm_cache_get(pool);
+    if (c->count == MP_SHM_CACHE)
+        shm_cache_flush(c, MP_SHM_CACHE / 2);
+    c->objs[c->count++] = ptr;
+}
+
+// 跨进程传对象只传偏移，对端用自己的映射换回指针
+uint64_t mp_shm_to_off(mp_shm_pool_t *pool, void *ptr) {
+    return (uint8_t *)ptr - (uint8_t *)pool->hdr;
+}
+
+void *mp_shm_from_off(mp_shm_pool_t *pool, uint64_t off) {
+    return (uint8_t *)pool->hdr + off;
+}
+
+/* ==========================================
+ * Benchmark
+ * ========================================== */
+
+#define TEST_THREADS 4
+#define TOTAL_OPS    5000000
+#define POOL_SIZE    100000
+
+void *worker(void *arg) {
+    global_pool_t *pool = arg;
+    mp_thread_init(pool);
+
+    for (int i = 0; i < TOTAL_OPS; i++) {
+        void *p = mp_alloc(pool);
+        *(int *)p = i;
+        mp_free(pool, p);
+    }
+    return NULL;
+}
+
+// 包 / 流表 / 定时器三个 pool，同一线程轮流用
+void *worker_multi(void *arg) {
+    global_pool_t **pools = arg;
+
+    for (int i = 0; i < TOTAL_OPS; i++) {
+        global_pool_t *pool = pools[i % 3];
+        void *p = mp_alloc(pool);
+        *(int *)p = i;
+        mp_free(pool, p);
+    }
+    return NULL;
+}
+
+// 会话记录 / 头部 / 包缓冲混合分配
+void *worker_sized(void *arg) {
+    static const size_t sizes[] = { 64, 256, 2048 };
+    (void)arg;
+
+    for (int i = 0; i < TOTAL_OPS; i++) {
+        void *p = mp_alloc_sized(sizes[i % ARRAY_SIZE(sizes)]);
+        *(int *)p = i;
+        mp_free_ptr(p);
+    }
+    return NULL;
+}
+
+// 每轮攒满两倍 cache 再全部释放，逼每个线程反复 refill / flush
+#define SCALE_HOLD    (LOCAL_CACHE_CAPACITY * 2)
+#define SCALE_ROUNDS  2000
+
+void *worker_depot(void *arg) {
+    global_pool_t *pool = arg;
+    void *held[SCALE_HOLD];
+    mp_thread_init(pool);
+
+    for (int r = 0; r < SCALE_ROUNDS; r++) {
+        for (int i = 0; i < SCALE_HOLD; i++)
+            held[i] = mp_alloc(pool);
+        for (int i = 0; i < SCALE_HOLD; i++)
+            mp_free(pool, held[i]);
+    }
+    return NULL;
+}
+
+// 线程数远多于核数：每个线程攒一小批再放，线程 cache 会各自囤一批
+#define MANY_THREADS  64
+#define MANY_HOLD     256
+#define MANY_ROUNDS   200
+
+typedef struct {
+    global_pool_t *pool;
+    pthread_barrier_t bar;    // 同时在场，线程 cache 退出前一直占着
+} many_arg_t;
+
+void *worker_many(void *arg) {
+    many_arg_t *a = arg;
+    global_pool_t *pool = a->pool;
+    void *held[MANY_HOLD];
+
+    pthread_barrier_wait(&a->bar);
+    for (int r = 0; r < MANY_ROUNDS; r++) {
+        for (int i = 0; i < MANY_HOLD; i++)
+            held[i] = mp_alloc(pool);
+        for (int i = 0; i < MANY_HOLD; i++)
+            mp_free(pool, held[i]);
+    }
+    pthread_barrier_wait(&a->bar);
+    return NULL;
+}
+
+// 生产者分配、消费者释放，中间一条 SPSC 环（RX -> TX 流水线）
+#define PC_RING   1024
+#define PC_OPS    1000000
+
+typedef struct {
+    global_pool_t *pool;
+    __attribute__((aligned(CACHE_LINE))) atomic_size_t head;
+    __attribute__((aligned(CACHE_LINE))) atomic_size_t tail;
+    void *slots[PC_RING];
+} pc_pipe_t;
+
+void *worker_producer(void *arg) {
+    pc_pipe_t *pp = arg;
+
+    for (int i = 0; i < PC_OPS; i++) {
+        void *p = mp_alloc(pp->pool);
+        *(int *)p = i;
+
+        size_t tail = atomic_load_explicit(&pp->tail, memory_order_relaxed);
+        while (tail - atomic_load_explicit(&pp->head, memory_order_acquire) == PC_RING)
+            sched_yield();
+        pp->slots[tail % PC_RING] = p;
+        atomic_store_explicit(&pp->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+void *worker_consumer(void *arg) {
+    pc_pipe_t *pp = arg;
+
+    for (int i = 0; i < PC_OPS; i++) {
+        size_t head = atomic_load_explicit(&pp->head, memory_order_relaxed);
+        while (atomic_load_explicit(&pp->tail, memory_order_acquire) == head)
+            sched_yield();
+        void *p = pp->slots[head % PC_RING];
+        atomic_store_explicit(&pp->head, head + 1, memory_order_release);
+
+        mp_free(pp->pool, p);
+    }
+    return NULL;
+}
+
+// TEST_THREADS / 2 对生产者 / 消费者共用一个 pool
+static double bench_pc(int flags) {
+    int pairs = TEST_THREADS / 2;
+    pc_pipe_t *pipes = aligned_alloc(CACHE_LINE, pairs * sizeof(pc_pipe_t));
+    pthread_t th[pairs * 2];
+    global_pool_t *pool = mp_pool_create_ex(&(mp_pool_attr_t){
+        .init_count = POOL_SIZE, .flags = flags });
+
+    struct timespec s, e;
+    clock_gettime(CLOCK_MONOTONIC, &s);
+    for (int i = 0; i < pairs; i++) {
+        pipes[i].pool = pool;
+        atomic_init(&pipes[i].head, 0);
+        atomic_init(&pipes[i].tail, 0);
+        pthread_create(&th[2 * i],     NULL, worker_producer, &pipes[i]);
+        pthread_create(&th[2 * i + 1], NULL, worker_consumer, &pipes[i]);
+    }
+    for (int i = 0; i < pairs * 2; i++)
+        pthread_join(th[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &e);
+
+    mp_pool_destroy(pool);
+    free(pipes);
+
+    double sec = (e.tv_sec - s.tv_sec) + (e.tv_nsec - s.tv_nsec) / 1e9;
+    return (pairs * PC_OPS * 2.0) / 1e6 / sec;
+}
+
+static double now_us(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+typedef struct {
+    global_pool_t *pool;
+    double *us;
+} startup_arg_t;
+
+void *worker_first(void *arg) {
+    startup_arg_t *a = arg;
+    mp_thread_init(a->pool);
+
+    double t0 = now_us();
+    void *p = mp_alloc(a->pool);
+    *(int *)p = 0;
+    *a->us = now_us() - t0;
+
+    mp_free(a->pool, p);
+    return NULL;
+}
+
+static double run_threads_n(int n, void *(*fn)(void *), void *arg) {
+    pthread_t th[n];
+    struct timespec s, e;
+    clock_gettime(CLOCK_MONOTONIC, &s);
+
+    for (int i = 0; i < n; i++)
+        pthread_create(&th[i], NULL, fn, arg);
+    for (int i = 0; i < n; i++)
+        pthread_join(th[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &e);
+    return (e.tv_sec - s.tv_sec) +
+           (e.tv_nsec - s.tv_nsec) / 1e9;
+}
+
+static double run_threads(void *(*fn)(void *), void *arg) {
+    return run_threads_n(TEST_THREADS, fn, arg);
+}
+
+// 事件循环式用法：pool 用光时 try 立即失败，等 eventfd 可读再重试
+#define TRY_OBJS  256
+
+typedef struct {
+    global_pool_t *pool;
+    void *objs[TRY_OBJS];
+} try_arg_t;
+
+// 另一个线程晚一点把对象还回来，退出时整批回到 depot
+void *worker_release(void *arg) {
+    try_arg_t *a = arg;
+    usleep(10000);
+    for (int i = 0; i < TRY_OBJS; i++)
+        mp_free(a->pool, a->objs[i]);
+    return NULL;
+}
+
+static void bench_try(void) {
+    try_arg_t a = { .pool = mp_pool_create(TRY_OBJS) };
+    int efd = mp_pool_eventfd(a.pool);
+
+    int n = 0;
+    while (n < TRY_OBJS && (a.objs[n] = mp_try_alloc(a.pool)) != NULL)
+        n++;
+    double t0 = now_us();
+    void *p = mp_try_alloc(a.pool);
+    double t1 = now_us();
+    printf("[Try] got %d objects, try on empty pool: %s in %.1f us\n",
+           n, p ? "object" : "NULL", t1 - t0);
+
+    struct timespec dl = ns_to_ts(mono_ns() + 5000000);
+    t0 = now_us();
+    p = mp_alloc_timed(a.pool, &dl);
+    printf("[Try] timed alloc with 5 ms deadline: %s after %.1f ms\n",
+           p ? "object" : "NULL", (now_us() - t0) / 1e3);
+
+    pthread_t th;
+    pthread_create(&th, NULL, worker_release, &a);
+    t0 = now_us();
+    struct pollfd pfd = { .fd = efd, .events = POLLIN };
+    int ready = poll(&pfd, 1, 1000);
+    uint64_t cnt;
+    if (ready > 0 && read(efd, &cnt, sizeof(cnt)) < 0)
+        perror("eventfd read");
+    p = mp_try_alloc(a.pool);
+    printf("[Try] eventfd %s after %.1f ms, retry: %s\n",
+           ready > 0 ? "readable" : "timeout", (now_us() - t0) / 1e3, p ? "object" : "NULL");
+    pthread_join(th, NULL);
+
+    mp_free(a.pool, p);
+    mp_pool_destroy(a.pool);
+}
+
+// 流量尖峰：一个线程把整个 pool 摸一遍再全部还回来
+#define SCAV_OBJS  40000
+
+void *worker_touch(void *arg) {
+    global_pool_t *pool = arg;
+    void **held = malloc(SCAV_OBJS * sizeof(void *));
+
+    for (int i = 0; i < SCAV_OBJS; i++) {
+        held[i] = mp_alloc(pool);
+        memset(held[i], 0xab, pool->obj_size);
+    }
+    for (int i = 0; i < SCAV_OBJS; i++)
+        mp_free(pool, held[i]);
+    free(held);
+    return NULL;
+}
+
+static double rss_mb(void) {
+    long pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%*s %ld", &pages) != 1)
+            pages = 0;
+        fclose(f);
+    }
+    return pages * sysconf(_SC_PAGESIZE) / 1048576.0;
+}
+
+static void bench_scavenge(void) {
+    global_pool_t *pool = mp_pool_create(SCAV_OBJS);
+    run_threads_n(1, worker_touch, pool);
+
+    double before = rss_mb();
+    double t0 = now_us();
+    int n = mp_pool_scavenge(pool, SCAV_OBJS / 10);
+    double t1 = now_us();
+    printf("[Scavenge] released %d chunks in %.1f ms, RSS %.1f -> %.1f MB\n",
+           n, (t1 - t0) / 1e3, before, rss_mb());
+
+    // 回收掉的 chunk 重新切出来用，不扩容
+    run_threads_n(1, worker_touch, pool);
+    printf("[Scavenge] after reuse: RSS %.1f MB, mapped %d objects\n", rss_mb(), pool->total);
+    mp_pool_destroy(pool);
+}
+
+// 父进程分配、子进程释放，中间只传偏移（pre-fork worker 之间交接 buffer）
+#define SHM_OBJS   4096
+#define SHM_MSGS   1000000
+#define SHM_BATCH  64
+
+static void shm_child(mp_shm_pool_t *pool, int rfd) {
+    uint64_t offs[SHM_BATCH];
+    long bad = 0, seq = 0;
+    ssize_t n;
+
+    while ((n = read(rfd, offs, sizeof(offs))) > 0) {
+        for (int i = 0; i < n / (ssize_t)sizeof(uint64_t); i++) {
+            long *p = mp_shm_from_off(pool, offs[i]);
+            if (*p != seq++)
+                bad++;
+            mp_shm_free(pool, p);
+        }
+    }
+    mp_shm_pool_detach(pool);
+    _exit(bad ? 1 : 0);
+}
+
+static void bench_shm(void) {
+    mp_shm_pool_t *pool = mp_shm_pool_create("mp_shm", 2048, SHM_OBJS);
+    int pfd[2];
+    if (!pool || pipe(pfd) < 0) {
+        printf("[Shm] unavailable\n");
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(pfd[1]);
+        shm_child(pool, pfd[0]);
+    }
+    close(pfd[0]);
+
+    uint64_t offs[SHM_BATCH];
+    int k = 0;
+    double t0 = now_us();
+    for (long i = 0; i < SHM_MSGS; i++) {
+        long *p = mp_shm_alloc(pool);
+        *p = i;
+        offs[k++] = mp_shm_to_off(pool, p);
+        if (k == SHM_BATCH || i == SHM_MSGS - 1) {
+            if (write(pfd[1], offs, k * sizeof(uint64_t)) < 0)
+                perror("write");
+            k = 0;
+        }
+    }
+    close(pfd[1]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    double sec = (now_us() - t0) / 1e6;
+    printf("[Shm] parent -> child %d objects via offsets: %.2f Mops/s, child %s\n",
+           SHM_MSGS, SHM_MSGS / 1e6 / sec,
+           WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "verified" : "FAILED");
+
+    mp_shm_pool_detach(pool);
+}
+
+// 线程 cache 与每 CPU cache 对比：吞吐和被切出来过的对象数（≈ 囤积的峰值）
+static void bench_percpu(int nthreads) {
+    static const char *names[] = { "tls", "percpu" };
+    int flags[] = { 0, MP_POOL_PERCPU };
+
+    for (int i = 0; i < 2; i++) {
+        mp_pool_attr_t attr = {
+            .init_count = nthreads * (MANY_HOLD + LOCAL_CACHE_CAPACITY),
+            .flags      = flags[i],
+        };
+        many_arg_t a = { .pool = mp_pool_create_ex(&attr) };
+        global_pool_t *pool = a.pool;
+        if (flags[i] && !pool->percpu)
+            printf("[PerCPU] rseq unavailable, falling back to thread caches\n");
+
+        pthread_barrier_init(&a.bar, NULL, nthreads);
+        double sec = run_threads_n(nthreads, worker_many, &a);
+        pthread_barrier_destroy(&a.bar);
+        int carved = pool->total - pool->carve_left;
+        printf("[PerCPU] %-6s %3d threads: %7.2f Mops/s, %6d objects carved (%.1f MB)\n",
+               names[i], nthreads, (nthreads * MANY_ROUNDS * MANY_HOLD * 2.0) / 1e6 / sec,
+               carved, carved * pool->obj_size / 1048576.0);
+        mp_pool_destroy(pool);
+    }
+}
+
+// 固定容量与自适应容量对比：慢路径次数和被切出来过的对象数
+static void bench_adapt(int nthreads) {
+    static const char *names[] = { "fixed", "adapt" };
+    int flags[] = { MP_POOL_FIXED_CACHE, 0 };
+
+    for (int i = 0; i < 2; i++) {
+        mp_pool_attr_t attr = {
+            .init_count = nthreads * (MANY_HOLD + LOCAL_CACHE_CAPACITY),
+            .flags      = flags[i],
+        };
+        many_arg_t a = { .pool = mp_pool_create_ex(&attr) };
+        global_pool_t *pool = a.pool;
+
+        pthread_barrier_init(&a.bar, NULL, nthreads);
+        double sec = run_threads_n(nthreads, worker_many, &a);
+        pthread_barrier_destroy(&a.bar);
+
+        mp_pool_stats_t st;
+        mp_pool_stats(pool, &st);
+        printf("[Adapt] %-5s %3d threads: %7.2f Mops/s, refill %lld flush %lld, %6d objects carved\n",
+               names[i], nthreads, (nthreads * MANY_ROUNDS * MANY_HOLD * 2.0) / 1e6 / sec,
+               st.refill_cnt, st.flush_cnt, st.high_water);
+        mp_pool_destroy(pool);
+    }
+}
+
+/* ==========================================
+ * Benchmark 套件：./a.out bench [N] [out.csv]
+ * 几种负载 × 1..N 线程，mp pool 对比 glibc malloc，抽样记每次操作的延迟
+ * ========================================== */
+
+#define BS_OPS        400000      // 每线程分配次数
+#define BS_SAMPLE     16          // 每 16 次操作计一次时
+#define BS_RING       16          // steady：手里轮换的对象数
+#define BS_BURST      1024        // burst：一口气分配这么多再全放掉
+#define BS_SLOTS      1024        // random：随机槽位，命中就放掉旧的，寿命服从几何分布
+#define BS_EX_OBJS    128         // exhaust：每线程摊到的对象数，远小于 PC_RING
+
+// 对数线性直方图：每个 2 的幂分 8 格，相对误差 12.5% 以内
+#define BS_SUB        8
+#define BS_BUCKETS    (64 * BS_SUB)
+
+typedef struct {
+    long long n[BS_BUCKETS];
+} bs_hist_t;
+
+static inline int bs_bucket(long long ns) {
+    if (ns < BS_SUB)
+        return ns < 0 ? 0 : (int)ns;
+    int e = 63 - __builtin_clzll(ns);                 // ns 在 [2^e, 2^(e+1))
+    return (e - 2) * BS_SUB + (int)((ns >> (e - 3)) & (BS_SUB - 1));
+}
+
+// 格子的下界
+static long long bs_bucket_ns(int b) {
+    if (b < BS_SUB)
+        return b;
+    int e = b / BS_SUB + 2;
+    return (long long)(BS_SUB + b % BS_SUB) << (e - 3);
+}
+
+static long long bs_percentile(const bs_hist_t *h, double q) {
+    long long total = 0, seen = 0;
+    for (int i = 0; i < BS_BUCKETS; i++)
+        total += h->n[i];
+    for (int i = 0; i < BS_BUCKETS; i++) {
+        seen += h->n[i];
+        if (total > 0 && seen >= q * total)
+            return bs_bucket_ns(i);
+    }
+    return 0;
+}
+
+// 两种分配器同一套接口；malloc 的 pool 参数不用
+typedef struct {
+    const char *name;
+    void *(*alloc)(global_pool_t *pool);
+    void  (*free)(global_pool_t *pool, void *ptr);
+} bs_allocator_t;
+
+static void *bs_malloc(global_pool_t *pool) {
+    (void)pool;
+    return malloc(OBJECT_SIZE);
+}
+
+static void bs_libc_free(global_pool_t *pool, void *ptr) {
+    (void)pool;
+    free(ptr);
+}
+
+static const bs_allocator_t bs_allocators[] = {
+    { "mp",     mp_alloc,  mp_free      },
+    { "malloc", bs_malloc, bs_libc_free },
+};
+
+typedef struct bs_run bs_run_t;
+
+typedef struct {
+    bs_run_t *run;
+    int idx;
+    uint64_t rng;
+    long long ops;          // alloc + free 次数
+    long long t_start, t_end;
+    bs_hist_t hist;
+} __attribute__((aligned(CACHE_LINE))) bs_thread_t;
+
+struct bs_run {
+    const bs_allocator_t *a;
+    global_pool_t *pool;
+    int nthreads;
+    pthread_barrier_t bar;
+    pc_pipe_t *pipes;       // pc：第 i 对线程共用 pipes[i]
+    bs_thread_t *th;
+};
+
+static inline uint64_t bs_rand(bs_thread_t *t) {
+    t->rng ^= t->rng << 13;
+    t->rng ^= t->rng >> 7;
+    t->rng ^= t->rng << 17;
+    return t->rng;
+}
+
+static inline void *bs_alloc(bs_thread_t *t) {
+    void *p;
+    if (t->ops++ % BS_SAMPLE) {
+        p = t->run->a->alloc(t->run->pool);
+    } else {
+        long long t0 = mono_ns();
+        p = t->run->a->alloc(t->run->pool);
+        t->hist.n[bs_bucket(mono_ns() - t0)]++;
+    }
+    *(long *)p = t->ops;
+    return p;
+}
+
+static inline void bs_free(bs_thread_t *t, void *p) {
+    if (t->ops++ % BS_SAMPLE) {
+        t->run->a->free(t->run->pool, p);
+    } else {
+        long long t0 = mono_ns();
+        t->run->a->free(t->run->pool, p);
+        t->hist.n[bs_bucket(mono_ns() - t0)]++;
+    }
+}
+
+static void bs_steady(bs_thread_t *t) {
+    void *ring[BS_RING] = { 0 };
+    for (int i = 0; i < BS_OPS; i++) {
+        void **slot = &ring[i % BS_RING];
+        if (*slot)
+            bs_free(t, *slot);
+        *slot = bs_alloc(t);
+    }
+    for (int i = 0; i < BS_RING; i++)
+        bs_free(t, ring[i]);
+}
+
+static void bs_burst(bs_thread_t *t) {
+    void *held[BS_BURST];
+    for (int r = 0; r < BS_OPS / BS_BURST; r++) {
+        for (int i = 0; i < BS_BURST; i++)
+            held[i] = bs_alloc(t);
+        for (int i = 0; i < BS_BURST; i++)
+            bs_free(t, held[i]);
+    }
+}
+
+static void bs_random(bs_thread_t *t) {
+    void **slots = calloc(BS_SLOTS, sizeof(void *));
+    for (int i = 0; i < BS_OPS; i++) {
+        void **slot = &slots[bs_rand(t) % BS_SLOTS];
+        if (*slot)
+            bs_free(t, *slot);
+        *slot = bs_alloc(t);
+    }
+    for (int i = 0; i < BS_SLOTS; i++)
+        if (slots[i])
+            bs_free(t, slots[i]);
+    free(slots);
+}
+
+// 偶数号生产、奇数号消费，对象全部跨线程释放
+static void bs_pc(bs_thread_t *t) {
+    pc_pipe_t *pp = &t->run->pipes[t->idx / 2];
+
+    for (int i = 0; i < BS_OPS; i++) {
+        if (t->idx % 2 == 0) {
+            void *p = bs_alloc(t);
+            size_t tail = atomic_load_explicit(&pp->tail, memory_order_relaxed);
+            while (tail - atomic_load_explicit(&pp->head, memory_order_acquire) == PC_RING)
+                sched_yield();
+            pp->slots[tail % PC_RING] = p;
+            atomic_store_explicit(&pp->tail, tail + 1, memory_order_release);
+        } else {
+            size_t head = atomic_load_explicit(&pp->head, memory_order_relaxed);
+            while (atomic_load_explicit(&pp->tail, memory_order_acquire) == head)
+                sched_yield();
+            void *p = pp->slots[head % PC_RING];
+            atomic_store_explicit(&pp->head, head + 1, memory_order_release);
+            bs_free(t, p);
+        }
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*fn)(bs_thread_t *t);
+    bool pool_only;       // 只对 mp pool 有意义
+    bool pairs;           // 线程两两配对，需要偶数个
+    int  pool_flags;
+    int  pool_objs;       // 每线程摊到的对象数，0 表示给足并允许扩容
+} bs_profile_t;
+
+// exhaust：生产者比消费者快，pool 比环小，生产者经常睡在 wait_cond 上等消费者还
+// 必须开 MP_POOL_REMOTE_FREE：否则还回来的对象囤在消费者的 cache 里，生产者永远等不到
+static const bs_profile_t bs_profiles[] = {
+    { "steady",  bs_steady, false, false, 0, 0 },
+    { "burst",   bs_burst,  false, false, 0, 0 },
+    { "pc",      bs_pc,     false, true,  0, 0 },
+    { "exhaust", bs_pc,     true,  true,  MP_POOL_REMOTE_FREE, BS_EX_OBJS },
+    { "random",  bs_random, false, false, 0, 0 },
+};
+
+static const bs_profile_t *bs_cur;
+
+static void *bs_worker(void *arg) {
+    bs_thread_t *t = arg;
+    if (t->run->pool)
+        mp_thread_init(t->run->pool);
+
+    pthread_barrier_wait(&t->run->bar);
+    t->t_start = mono_ns();
+    bs_cur->fn(t);
+    // 跑完就退出：exhaust 下先跑完的线程要退出才交还 cache，留着会把别人饿死
+    t->t_end = mono_ns();
+    return NULL;
+}
+
+static void bs_one(const bs_profile_t *prof, const bs_allocator_t *a, int n, FILE *csv) {
+    bs_run_t run = { .a = a, .nthreads = n };
+    mp_pool_attr_t attr = {
+        .init_count = n * (BS_SLOTS + 2 * LOCAL_CACHE_CAPACITY),
+        .grow_count = POOL_SIZE,
+        .max_count  = 1 << 24,
+    };
+    if (prof->pool_objs)
+        attr = (mp_pool_attr_t){ .init_count = n * prof->pool_objs };
+    attr.flags = prof->pool_flags;
+    if (a->alloc == mp_alloc)
+        run.pool = mp_pool_create_ex(&attr);
+
+    run.th = aligned_alloc(CACHE_LINE, n * sizeof(bs_thread_t));
+    memset(run.th, 0, n * sizeof(bs_thread_t));
+    run.pipes = aligned_alloc(CACHE_LINE, (n / 2 + 1) * sizeof(pc_pipe_t));
+    for (int i = 0; i < n / 2 + 1; i++) {
+        atomic_init(&run.pipes[i].head, 0);
+        atomic_init(&run.pipes[i].tail, 0);
+    }
+    pthread_barrier_init(&run.bar, NULL, n);
+
+    bs_cur = prof;
+    pthread_t th[n];
+    for (int i = 0; i < n; i++) {
+        run.th[i].run = &run;
+        run.th[i].idx = i;
+        run.th[i].rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+        pthread_create(&th[i], NULL, bs_worker, &run.th[i]);
+    }
+    for (int i = 0; i < n; i++)
+        pthread_join(th[i], NULL);
+
+    bs_hist_t all = { { 0 } };
+    long long ops = 0, t0 = run.th[0].t_start, t1 = run.th[0].t_end;
+    for (int i = 0; i < n; i++) {
+        bs_thread_t *t = &run.th[i];
+        ops += t->ops;
+        if (t->t_start < t0) t0 = t->t_start;
+        if (t->t_end > t1)   t1 = t->t_end;
+        for (int b = 0; b < BS_BUCKETS; b++)
+            all.n[b] += t->hist.n[b];
+    }
+
+    double mops = ops * 1e3 / (t1 - t0);
+    long long p50 = bs_percentile(&all, 0.50);
+    long long p99 = bs_percentile(&all, 0.99);
+    long long p999 = bs_percentile(&all, 0.999);
+    printf("%-8s %-7s %4d %10.2f %9lld %9lld %9lld\n",
+           prof->name, a->name, n, mops, p50, p99, p999);
+    if (csv)
+        fprintf(csv, "%s,%s,%d,%.3f,%lld,%lld,%lld\n",
+                prof->name, a->name, n, mops, p50, p99, p999);
+
+    pthread_barrier_destroy(&run.bar);
+    free(run.pipes);
+    free(run.th);
+    if (run.pool)
+        mp_pool_destroy(run.pool);
+}
+
+// 线程数 1, 2, 4 ... 直到 max_threads；延迟含一次 clock_gettime 的开销
+static void bench_suite(int max_threads, const char *csv_path) {
+    FILE *csv = NULL;
+    if (csv_path) {
+        csv = fopen(csv_path, "w");
+        if (!csv) {
+            perror(csv_path);
+            return;
+        }
+        fprintf(csv, "profile,allocator,threads,mops,p50_ns,p99_ns,p999_ns\n");
+    }
+
+    long long tmin = -1;
+    for (int i = 0; i < 1000; i++) {
+        long long a = mono_ns(), b = mono_ns();
+        if (tmin < 0 || b - a < tmin)
+            tmin = b - a;
+    }
+    printf("timer overhead ~%lld ns, 1/%d ops sampled\n", tmin, BS_SAMPLE);
+    printf("%-8s %-7s %4s %10s %9s %9s %9s\n",
+           "profile", "alloc", "thr", "Mops/s", "p50(ns)", "p99(ns)", "p999(ns)");
+
+    for (size_t p = 0; p < ARRAY_SIZE(bs_profiles); p++) {
+        const bs_profile_t *prof = &bs_profiles[p];
+        for (int n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads) {
+            for (size_t a = 0; a < ARRAY_SIZE(bs_allocators); a++) {
+                if (prof->pairs && n % 2)
+                    break;
+                if (prof->pool_only && bs_allocators[a].alloc != mp_alloc)
+                    continue;
+                bs_one(prof, &bs_allocators[a], n, csv);
+            }
+            if (n == max_threads)
+                break;
+        }
+    }
+
+    if (csv)
+        fclose(csv);
+}
+
+// ./a.out scale [N]：1..N 线程下对比自旋锁与无锁 depot
+static void bench_depot_scale(int max_threads) {
+    static const char *names[] = { "lockfree", "spin" };
+
+    printf("%-8s %12s %12s\n", "threads", names[0], names[1]);
+    for (int n = 1; n <= max_threads; n++) {
+        printf("%-8d", n);
+        for (int mode = MP_DEPOT_LOCKFREE; mode <= MP_DEPOT_SPIN; mode++) {
+            mp_pool_attr_t attr = {
+                .init_count = n * (SCALE_HOLD + LOCAL_CACHE_CAPACITY) + POOL_SIZE,
+                .depot_mode = mode,
+            };
+            global_pool_t *pool = mp_pool_create_ex(&attr);
+
+            double sec = run_threads_n(n, worker_depot, pool);
+            printf(" %9.2f M/s", (n * SCALE_ROUNDS * SCALE_HOLD * 2.0) / 1e6 / sec);
+
+            mp_pool_destroy(pool);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "scale") == 0) {
+        int n = (argc > 2) ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        bench_depot_scale(n > 0 ? n : 1);
+        return 0;
+    }
+    // ./a.out bench [N] [out.csv]：负载 × 线程数的吞吐和延迟分位，对比 malloc
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        int n = (argc > 2) ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        bench_suite(n > 0 ? n : 1, argc > 3 ? argv[3] : NULL);
+        return 0;
+    }
+    // ./a.out percpu [N]：N 个线程下对比线程 cache 和每 CPU cache
+    if (argc > 1 && strcmp(argv[1], "percpu") == 0) {
+        int n = (argc > 2) ? atoi(argv[2]) : MANY_THREADS;
+        bench_percpu(n > 0 ? n : 1);
+        return 0;
+    }
+
+    global_pool_t *pool = mp_pool_create(POOL_SIZE);
+
+    double sec = run_threads(worker, pool);
+
+    printf("Time: %.3f s\n", sec);
+    printf("Rate: %.2f Mops/s\n",
+           (TEST_THREADS * TOTAL_OPS * 2.0) / 1e6 / sec);
+
+    // 线程都退出了，计数已经并进 pool
+    mp_pool_stats_t st;
+    mp_pool_stats(pool, &st);
+    printf("[Stats] alloc %lld free %lld refill %lld flush %lld wait %lld (%.1f ms) spin %.1f ms\n",
+           st.alloc_cnt, st.free_cnt, st.refill_cnt, st.flush_cnt,
+           st.wait_cnt, st.wait_ns / 1e6, st.spin_ns / 1e6);
+    printf("[Stats] high water %d / %d, depot %ld, cached %ld, in use %ld, cache limits %ld\n",
+           st.high_water, st.total, st.depot_free, st.cached, st.in_use, st.cache_limit);
+
+    mp_pool_destroy(pool);
+
+    printf("[PC] depot:       %.2f Mops/s\n", bench_pc(0));
+    printf("[PC] remote-free: %.2f Mops/s\n", bench_pc(MP_POOL_REMOTE_FREE));
+
+    bench_percpu(MANY_THREADS);
+    bench_adapt(MANY_THREADS);
+    bench_try();
+    bench_scavenge();
+    bench_shm();
+
+    // 从一个 chunk 起步，按需扩容到 POOL_SIZE
+    mp_pool_attr_t attr = {
+        .init_count = 1000,
+        .grow_count = 4000,
+        .max_count  = POOL_SIZE,
+        .flags      = MP_POOL_THP,
+    };
+    pool = mp_pool_create_ex(&attr);
+    sec = run_threads(worker_depot, pool);
+    printf("[Grow] Time: %.3f s, mapped %d / %d objects\n", sec, pool->total, POOL_SIZE);
+    mp_pool_destroy(pool);
+
+    // 启动耗时不随 pool 大小增长：创建 + 首次分配
+    for (int n = POOL_SIZE; n <= POOL_SIZE * 10; n *= 10) {
+        double t0 = now_us();
+        pool = mp_pool_create(n);
+        double t1 = now_us();
+        double first = 0;
+        run_threads_n(1, worker_first, &(startup_arg_t){ pool, &first });
+        printf("[Startup] %8d objects: create %.1f us + first alloc %.1f us\n",
+               n, t1 - t0, first);
+        mp_pool_destroy(pool);
+    }
+
+    // 可选：并行预缺页，把缺页成本挪到启动阶段
+    pool = mp_pool_create(POOL_SIZE);
+    double t0 = now_us();
+    mp_pool_prefault(pool, TEST_THREADS);
+    printf("[Prefault] %d objects with %d threads: %.1f ms\n",
+           POOL_SIZE, TEST_THREADS, (now_us() - t0) / 1e3);
+    mp_pool_destroy(pool);
+
+    // 每个 pool 自己的对象大小和 cache 参数
+    global_pool_t *pools[3] = {
+        mp_pool_create_ex(&(mp_pool_attr_t){ .obj_size = 2048, .init_count = POOL_SIZE }),
+        mp_pool_create_ex(&(mp_pool_attr_t){ .obj_size = 256,  .init_count = POOL_SIZE,
+                                             .cache_capacity = 256, .batch_size = 16 }),
+        mp_pool_create_ex(&(mp_pool_attr_t){ .obj_size = 64,   .init_count = POOL_SIZE,
+                                             .cache_capacity = 1024, .batch_size = 64 }),
+    };
+    sec = run_threads(worker_multi, pools);
+    printf("[Multi] Time: %.3f s\n", sec);
+    printf("[Multi] Rate: %.2f Mops/s\n",
+           (TEST_THREADS * TOTAL_OPS * 2.0) / 1e6 / sec);
+    for (int i = 0; i < 3; i++)
+        mp_pool_destroy(pools[i]);
+
+    // 64B / 256B / 2KB 各一个 class
+    int counts[MP_NUM_CLASSES] = { [0] = POOL_SIZE, [2] = POOL_SIZE, [5] = POOL_SIZE };
+    mp_sizeclass_init(counts);
+
+    sec = run_threads(worker_sized, NULL);
+    printf("[Sized] Time: %.3f s\n", sec);
+    printf("[Sized] Rate: %.2f Mops/s\n",
+           (TEST_THREADS * TOTAL_OPS * 2.0) / 1e6 / sec);
+
+    mp_sizeclass_destroy();
     return 0;
 }